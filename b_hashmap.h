@@ -0,0 +1,237 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Description: -------------------
+	bhashmap
+	- "b hash map", open addressing with linear probing
+	- one flat array of slots, allocated from GameMemory like blist
+	- keys and values must be plain data, no destructors are run
+	- transient maps are rebuilt every frame: set() again after the
+	  transient memory is emptied, no need to clear
+
+Functions:
+	.set(): reserve the memory, permanent or transient
+	.insert(): add or overwrite. returns pointer to the value
+	.get(): pointer to the value, 0 if missing
+	.remove(): backward shift delete, no tombstones
+	.clear(): empty the map, keeps the memory
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#ifndef _INCLUDE_BHASHMAP_
+#define _INCLUDE_BHASHMAP_
+
+#include <type_traits>
+
+// murmur3 finalizer
+inline u4 bhash_u8(u8 x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (u4)x;
+}
+
+// FNV-1a
+inline u4 bhash_string(const char* str)
+{
+	u4 hash = 2166136261u;
+	while (*str) {
+		hash ^= (u1)*str++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Integers, enums and pointers. Specialize for other key types.
+template <typename K>
+struct bhash
+{
+	inline u4 operator()(const K &key) const
+	{
+		return bhash_u8((u8)key);
+	}
+};
+template <typename K>
+struct bhash<K*>
+{
+	inline u4 operator()(K* key) const
+	{
+		return bhash_u8((u8)(uintptr_t)key);
+	}
+};
+template <>
+struct bhash<const char*>
+{
+	inline u4 operator()(const char* key) const
+	{
+		return bhash_string(key);
+	}
+};
+
+template <typename K>
+struct bequal
+{
+	inline b4 operator()(const K &a, const K &b) const
+	{
+		return a == b;
+	}
+};
+template <>
+struct bequal<const char*>
+{
+	inline b4 operator()(const char* a, const char* b) const
+	{
+		return strcmp(a, b) == 0;
+	}
+};
+
+template <typename K, typename V, typename Hash = bhash<K>, typename Equal = bequal<K> >
+struct bhashmap
+{
+	static_assert(std::is_trivially_destructible<K>::value && std::is_trivially_destructible<V>::value,
+	              "bhashmap keys and values must be plain data");
+
+	struct Slot {
+		u4 hash; // 0 means empty
+		K key;
+		V value;
+	};
+
+	Slot* slots;
+	u4 capacity; // power of two
+	u4 length;
+	GameMemory* mem_arena;
+	b4 transient;
+
+	// Room for max entries before it has to grow
+	void set(GameMemory &memory, u4 max, b4 use_transient = false)
+	{
+		mem_arena = &memory;
+		transient = use_transient;
+		length = 0;
+		capacity = 0;
+		slots = 0;
+		u4 needed = 16;
+		while (needed * 3 < max * 4) {
+			needed *= 2;
+		}
+		allocate(needed);
+	}
+
+	inline u4 size() const
+	{
+		return length;
+	}
+
+	V* get(const K &key) const
+	{
+		u4 hash = hash_key(key);
+		u4 mask = capacity - 1;
+		for (u4 i = hash & mask; slots[i].hash; i = (i + 1) & mask)
+		{
+			if (slots[i].hash == hash && Equal()(slots[i].key, key)) {
+				return &slots[i].value;
+			}
+		}
+		return 0;
+	}
+
+	V* insert(const K &key, const V &value)
+	{
+		if ((length + 1) * 4 > capacity * 3) {
+			grow();
+		}
+		u4 hash = hash_key(key);
+		u4 mask = capacity - 1;
+		u4 i = hash & mask;
+		for (; slots[i].hash; i = (i + 1) & mask)
+		{
+			if (slots[i].hash == hash && Equal()(slots[i].key, key)) {
+				slots[i].value = value;
+				return &slots[i].value;
+			}
+		}
+		slots[i].hash = hash;
+		slots[i].key = key;
+		slots[i].value = value;
+		length++;
+		return &slots[i].value;
+	}
+
+	// Shifts the rest of the probe run back instead of leaving a tombstone
+	b4 remove(const K &key)
+	{
+		u4 hash = hash_key(key);
+		u4 mask = capacity - 1;
+		u4 i = hash & mask;
+		for (;; i = (i + 1) & mask)
+		{
+			if (!slots[i].hash) {
+				return false;
+			}
+			if (slots[i].hash == hash && Equal()(slots[i].key, key)) {
+				break;
+			}
+		}
+		u4 hole = i;
+		for (u4 j = (i + 1) & mask; slots[j].hash; j = (j + 1) & mask)
+		{
+			u4 home = slots[j].hash & mask;
+			// move j back if its home isn't in (hole, j]
+			if (((j - home) & mask) >= ((j - hole) & mask)) {
+				slots[hole] = slots[j];
+				hole = j;
+			}
+		}
+		slots[hole].hash = 0;
+		length--;
+		return true;
+	}
+
+	void clear()
+	{
+		memset((void*)slots, 0, sizeof(Slot) * capacity);
+		length = 0;
+	}
+
+private:
+	inline u4 hash_key(const K &key) const
+	{
+		u4 hash = Hash()(key);
+		return hash ? hash : 1;
+	}
+
+	void allocate(u4 new_capacity)
+	{
+		u8 bytes = sizeof(Slot) * (u8)new_capacity;
+		slots = transient ? (Slot*)alloc_transient_aligned(*mem_arena, bytes)
+		                  : (Slot*)alloc_aligned(*mem_arena, bytes);
+		memset((void*)slots, 0, bytes);
+		capacity = new_capacity;
+	}
+
+	// Rehash into twice the slots, old permanent memory is freed for reuse
+	void grow()
+	{
+		Slot* old_slots = slots;
+		u4 old_capacity = capacity;
+		allocate(capacity * 2);
+		u4 mask = capacity - 1;
+		for (u4 i = 0; i < old_capacity; i++)
+		{
+			if (!old_slots[i].hash) {
+				continue;
+			}
+			u4 j = old_slots[i].hash & mask;
+			while (slots[j].hash) {
+				j = (j + 1) & mask;
+			}
+			slots[j] = old_slots[i];
+		}
+		if (!transient) {
+			free_block(*mem_arena, old_slots, sizeof(Slot) * (u8)old_capacity);
+		}
+	}
+};
+
+#endif
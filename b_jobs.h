@@ -0,0 +1,262 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Description: -------------------
+	JobPool
+	- fixed set of worker threads, the calling thread is worker 0
+	- work is split into chunks of a range, each worker starts with an
+	  equal share and steals half of another worker's share when it runs out
+	- every worker gets its own scratch arena, one of GameMemory's
+	  thread arenas (see init_thread_arenas() in b_memory.h)
+	- one job at a time, don't call parallel_for() from inside a job
+
+Functions:
+	init_job_pool(): start the threads and carve the scratch arenas
+	shutdown_job_pool(): join the threads
+	parallel_for(): body(begin, end, worker, scratch) over chunks of [0, count)
+	parallel_foreach(): body(item, index, scratch) over a blist / btlist
+	parallel_reduce(): map every item, then combine the per-worker results
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#ifndef _INCLUDE_BJOBS_
+#define _INCLUDE_BJOBS_
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef MAX_JOB_THREADS
+#define MAX_JOB_THREADS 64
+#endif
+
+typedef void (*JobFunction)(void* context, u4 begin, u4 end, u4 worker, GameMemory &scratch);
+
+struct JobPool
+{
+	// chunks [begin, end) left for one worker, packed as begin << 32 | end
+	// so the owner and thieves can both update it with one CAS
+	struct B_CACHE_ALIGNED WorkerRange {
+		std::atomic<u8> range;
+	};
+
+	std::thread threads[MAX_JOB_THREADS];
+	WorkerRange ranges[MAX_JOB_THREADS];
+	u4 worker_count;
+	GameMemory* memory;
+
+	// current job
+	JobFunction function;
+	void* context;
+	u4 count;
+	u4 chunk_size;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	u4 generation;
+	b4 quit;
+	B_CACHE_ALIGNED std::atomic<u4> working;
+};
+
+inline b4 take_chunk(JobPool &pool, u4 worker, u4 &chunk)
+{
+	std::atomic<u8> &range = pool.ranges[worker].range;
+	u8 current = range.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		u4 begin = (u4)(current >> 32);
+		u4 end = (u4)current;
+		if (begin >= end) {
+			return false;
+		}
+		if (range.compare_exchange_weak(current, ((u8)(begin + 1) << 32) | end, std::memory_order_relaxed)) {
+			chunk = begin;
+			return true;
+		}
+	}
+}
+
+// Move the back half of some other worker's range into ours
+b4 steal_chunks(JobPool &pool, u4 worker)
+{
+	for (u4 i = 1; i < pool.worker_count; i++)
+	{
+		std::atomic<u8> &victim = pool.ranges[(worker + i) % pool.worker_count].range;
+		u8 current = victim.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			u4 begin = (u4)(current >> 32);
+			u4 end = (u4)current;
+			if (begin >= end) {
+				break;
+			}
+			u4 mid = end - (end - begin + 1) / 2;
+			if (victim.compare_exchange_weak(current, ((u8)begin << 32) | mid, std::memory_order_relaxed)) {
+				pool.ranges[worker].range.store(((u8)mid << 32) | end, std::memory_order_relaxed);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void run_worker(JobPool &pool, u4 worker)
+{
+	GameMemory &scratch = pool.memory->thread_arenas[worker];
+	u4 chunk;
+	do {
+		while (take_chunk(pool, worker, chunk))
+		{
+			u4 begin = chunk * pool.chunk_size;
+			u4 end = begin + pool.chunk_size < pool.count ? begin + pool.chunk_size : pool.count;
+			pool.function(pool.context, begin, end, worker, scratch);
+		}
+	} while (steal_chunks(pool, worker));
+	pool.working.fetch_sub(1, std::memory_order_release);
+}
+
+void job_thread(JobPool* pool, u4 worker)
+{
+	u4 seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->wake.wait(lock, [&] { return pool->quit || pool->generation != seen; });
+			if (pool->quit) {
+				return;
+			}
+			seen = pool->generation;
+		}
+		run_worker(*pool, worker);
+	}
+}
+
+// thread_count includes the calling thread. 0 uses every core.
+// Returns false without starting threads if the scratch arenas don't fit.
+b4 init_job_pool(JobPool &pool, GameMemory &memory, u4 thread_count, u8 scratch_bytes_per_thread)
+{
+	if (thread_count == 0) {
+		thread_count = std::thread::hardware_concurrency();
+	}
+	if (thread_count == 0) {
+		thread_count = 1;
+	}
+	if (thread_count > MAX_JOB_THREADS) {
+		thread_count = MAX_JOB_THREADS;
+	}
+	pool.worker_count = 0;
+	if (memory.thread_arena_count < thread_count
+		&& !init_thread_arenas(memory, thread_count, scratch_bytes_per_thread))
+	{
+		return false;
+	}
+	pool.memory = &memory;
+	pool.worker_count = thread_count;
+	pool.generation = 0;
+	pool.quit = false;
+	pool.working.store(0);
+	for (u4 i = 1; i < thread_count; i++) {
+		pool.threads[i] = std::thread(job_thread, &pool, i);
+	}
+	return true;
+}
+
+void shutdown_job_pool(JobPool &pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.quit = true;
+	}
+	pool.wake.notify_all();
+	for (u4 i = 1; i < pool.worker_count; i++) {
+		pool.threads[i].join();
+	}
+}
+
+// Run function over [0, count) in chunks of chunk_size, returns when all chunks are done
+void run_job(JobPool &pool, JobFunction function, void* context, u4 count, u4 chunk_size)
+{
+	if (count == 0) {
+		return;
+	}
+	u4 chunks = (count + chunk_size - 1) / chunk_size;
+	u4 workers = pool.worker_count;
+	for (u4 i = 0; i < workers; i++) {
+		u4 begin = (u4)((u8)chunks * i / workers);
+		u4 end = (u4)((u8)chunks * (i + 1) / workers);
+		pool.ranges[i].range.store(((u8)begin << 32) | end, std::memory_order_relaxed);
+	}
+	pool.function = function;
+	pool.context = context;
+	pool.count = count;
+	pool.chunk_size = chunk_size;
+	pool.working.store(workers, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.generation++;
+	}
+	pool.wake.notify_all();
+
+	run_worker(pool, 0);
+	while (pool.working.load(std::memory_order_acquire) != 0) {
+		std::this_thread::yield();
+	}
+}
+
+template <typename F>
+void run_job_function(void* context, u4 begin, u4 end, u4 worker, GameMemory &scratch)
+{
+	(*(F*)context)(begin, end, worker, scratch);
+}
+
+// body(u4 begin, u4 end, u4 worker, GameMemory &scratch)
+template <typename F>
+inline void parallel_for(JobPool &pool, u4 count, u4 chunk_size, F body)
+{
+	run_job(pool, run_job_function<F>, &body, count, chunk_size);
+}
+
+// body(item, u4 index, GameMemory &scratch) for every item of a blist / btlist
+template <typename L, typename F>
+inline void parallel_foreach(JobPool &pool, L &list, F body, u4 chunk_size = 256)
+{
+	parallel_for(pool, list.length, chunk_size, [&](u4 begin, u4 end, u4, GameMemory &scratch) {
+		for (u4 i = begin; i < end; i++) {
+			body(list[i], i, scratch);
+		}
+	});
+}
+
+/*
+	map(item, u4 index) -> R for every item, folded with reduce(R, R) -> R.
+	Each worker folds into its own cache line, the partials are combined
+	on the calling thread.
+*/
+template <typename R, typename L, typename Map, typename Reduce>
+R parallel_reduce(JobPool &pool, L &list, R identity, Map map, Reduce reduce, u4 chunk_size = 256)
+{
+	struct B_CACHE_ALIGNED Partial {
+		R value;
+	};
+	TemporaryMemory temp = begin_temporary_memory(*pool.memory);
+	Partial* partials = (Partial*)alloc_transient_aligned(*pool.memory, sizeof(Partial) * pool.worker_count);
+	for (u4 i = 0; i < pool.worker_count; i++) {
+		new (&partials[i]) Partial{identity};
+	}
+
+	parallel_for(pool, list.length, chunk_size, [&](u4 begin, u4 end, u4 worker, GameMemory&) {
+		R value = partials[worker].value;
+		for (u4 i = begin; i < end; i++) {
+			value = reduce(value, map(list[i], i));
+		}
+		partials[worker].value = value;
+	});
+
+	R result = identity;
+	for (u4 i = 0; i < pool.worker_count; i++) {
+		result = reduce(result, partials[i].value);
+	}
+	end_temporary_memory(temp);
+	return result;
+}
+
+#endif
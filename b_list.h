@@ -9,6 +9,27 @@ Description: -------------------
 	blist
 	- can reallocate itself to expand
 	- checks bounds on push
+	btlist
+	- "b typed list", blist as a class template
+	- element size known at compile time, can be passed to functions
+	- moves non-trivial types when it grows
+	bsmall
+	- blimp with its first N elements stored inline in the owner
+	- spills to the arena only when it grows past N
+	bseglist
+	- "b segmented list", grows by linking fixed size chunks
+	- never copies elements, pointers into it stay valid
+	bsoa
+	- "b structure of arrays", one contiguous column per field
+	- columns share one length, push and swap_remove touch every column
+	bslotmap
+	- dense array of items addressed by 32 bit handles
+	- handle = 12 bit generation << 20 | slot index, stale handles resolve to 0
+	- freed slots are reused oldest first and generation 0 is never used,
+	  so a zeroed handle means "no handle"
+	bspsc / bmpsc
+	- bounded lock-free ring buffers, single or multi producer, single consumer
+	- storage comes from the arena once in set(), no allocation after that
 
 Functions:
 	blimp_set(): reserve the memory
@@ -16,12 +37,25 @@ Functions:
 	.[]: get memory without need to cast
 	.push():  increase length. returns pointer to new item
 	foreach(): loop through contents
+	btlist.set(): reserve the memory, permanent or transient
+	btlist.append() / .resize() / .reserve(): bulk versions of push
+	bseglist.chunk(): contiguous run of elements, for iterating by chunk
+	bsoa.column<I>(): array of field I, cache line aligned for SIMD
+	bslotmap.insert() / .remove() / .get(): O(1), items stay packed in .items
+	bspsc/bmpsc.push() / .pop(): single item or batch, return how many moved
+	  (bmpsc batch push is all or nothing: count or 0)
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
 #ifndef _INCLUDE_BLISTS_
 #define _INCLUDE_BLISTS_
 
+#include <new>          /* placement new */
+#include <type_traits>
+#include <utility>      /* std::move */
+#include <tuple>        /* std::tuple_element */
+#include <atomic>
+
 #ifdef _INCLUDE_BLIMP_TOO_
 #define blimp(VAR_TYPE,VAR_NAME) struct { \
 		VAR_TYPE* list; \
@@ -42,11 +76,20 @@ Functions:
 #endif
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
+// The block holds max_length - 1 elements. Grows in place at the top of
+// the arena, otherwise the old block is freed for reuse.
+// push() has already counted the new element, only length - 1 are in the block.
 void* BLIST_REALLOCATE_MORE_SPACE(void* mem_start, uint32_t element_size, uint32_t length, uint32_t &max_length, GameMemory* mem_arena)
 {
+	uint64_t old_size = (uint64_t)element_size * (max_length - 1);
 	max_length = ((max_length-1) * 2) + 1;
-	void* mem_new_start = alloc(*mem_arena, element_size * max_length);
-	memcpy(mem_new_start,mem_start,element_size * length);
+	uint64_t new_size = (uint64_t)element_size * (max_length - 1);
+	if (grow_in_place(*mem_arena, mem_start, old_size, new_size)) {
+		return mem_start;
+	}
+	void* mem_new_start = alloc_block(*mem_arena, new_size);
+	memcpy(mem_new_start,mem_start,(uint64_t)element_size * (length - 1));
+	free_block(*mem_arena, mem_start, old_size);
 	return mem_new_start;
 }	
 
@@ -88,4 +131,815 @@ void* BLIST_REALLOCATE_MORE_SPACE(void* mem_start, uint32_t element_size, uint32
 
 #define foreach(VAR_LOC,VAR_INDEX) for (s4 VAR_INDEX = 0; VAR_INDEX < VAR_LOC.length; VAR_INDEX++)
 
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+template <typename T>
+struct btlist
+{
+	T* list;
+	u4 length;
+	u4 max_length;
+	GameMemory* mem_arena;
+	b4 transient;
+
+	void set(GameMemory &memory, u4 max, b4 use_transient = false)
+	{
+		length = 0;
+		max_length = 0;
+		list = 0;
+		mem_arena = &memory;
+		transient = use_transient;
+		reserve(max);
+	}
+
+	inline T& operator[](u4 index) const
+	{
+		return list[index];
+	}
+	inline u4 size() const
+	{
+		return length;
+	}
+	inline T* begin() const
+	{
+		return list;
+	}
+	inline T* end() const
+	{
+		return list + length;
+	}
+
+	// Index of item if it points into the list, length otherwise
+	inline u4 own_index(const T* item) const
+	{
+		return item >= list && item < list + length ? (u4)(item - list) : length;
+	}
+
+	// Grow to hold at least max elements. Grows in place at the top of
+	// the arena, otherwise old permanent memory is freed for reuse.
+	void reserve(u4 max)
+	{
+		if (max <= max_length) {
+			return;
+		}
+		uint64_t old_size = (uint64_t)sizeof(T) * max_length;
+		uint64_t new_size = (uint64_t)sizeof(T) * max;
+		if (max_length && grow_in_place(*mem_arena, list, old_size, new_size)) {
+			max_length = max;
+			return;
+		}
+		T* mem_new;
+		if (transient) {
+			mem_new = (T*)alloc_transient_aligned(*mem_arena, new_size, alignof(T));
+		} else if (alignof(T) <= B_BLOCK_ALIGNMENT) {
+			mem_new = (T*)alloc_block(*mem_arena, new_size);
+			max = (u4)(new_size / sizeof(T));
+		} else {
+			mem_new = (T*)alloc_aligned(*mem_arena, new_size, alignof(T));
+		}
+		if (std::is_trivially_copyable<T>::value) {
+			if (length) {
+				memcpy((void*)mem_new, (const void*)list, sizeof(T) * length);
+			}
+		} else {
+			for (u4 i = 0; i < length; i++) {
+				new (&mem_new[i]) T(std::move(list[i]));
+				list[i].~T();
+			}
+		}
+		if (!transient && max_length) {
+			free_block(*mem_arena, list, old_size);
+		}
+		list = mem_new;
+		max_length = max;
+	}
+
+	inline T* push()
+	{
+		if (length == max_length) {
+			reserve(max_length ? max_length * 2 : 4);
+		}
+		return new (&list[length++]) T;
+	}
+	// item may be one of our own, reserve() moves it before freeing the old block
+	inline T* push(const T &item)
+	{
+		if (length == max_length) {
+			u4 own = own_index(&item);
+			reserve(max_length ? max_length * 2 : 4);
+			if (own != length) {
+				return new (&list[length++]) T(list[own]);
+			}
+		}
+		return new (&list[length++]) T(item);
+	}
+	inline T* push(T &&item)
+	{
+		if (length == max_length) {
+			u4 own = own_index(&item);
+			reserve(max_length ? max_length * 2 : 4);
+			if (own != length) {
+				return new (&list[length++]) T(std::move(list[own]));
+			}
+		}
+		return new (&list[length++]) T(std::move(item));
+	}
+
+	void append(const T* items, u4 count)
+	{
+		if (length + count > max_length) {
+			u4 own = own_index(items);
+			reserve(length + count > max_length * 2 ? length + count : max_length * 2);
+			if (own != length) {
+				items = list + own;
+			}
+		}
+		if (std::is_trivially_copyable<T>::value) {
+			memcpy((void*)(list + length), (const void*)items, sizeof(T) * count);
+		} else {
+			for (u4 i = 0; i < count; i++) {
+				new (&list[length + i]) T(items[i]);
+			}
+		}
+		length += count;
+	}
+
+	// New elements are default initialized, same as push()
+	void resize(u4 new_length)
+	{
+		reserve(new_length);
+		if (!std::is_trivially_destructible<T>::value) {
+			for (u4 i = new_length; i < length; i++) {
+				list[i].~T();
+			}
+		}
+		for (u4 i = length; i < new_length; i++) {
+			new (&list[i]) T;
+		}
+		length = new_length;
+	}
+
+	inline void pop()
+	{
+		length--;
+		list[length].~T();
+	}
+	inline void clear()
+	{
+		resize(0);
+	}
+
+	inline T* last()
+	{
+		if (length > 0) {
+			return &list[length-1];
+		} else {
+			return &list[0];
+		}
+	}
+};
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+template <typename T, u4 CHUNK_LENGTH = 64>
+struct bseglist
+{
+	static_assert((CHUNK_LENGTH & (CHUNK_LENGTH - 1)) == 0, "CHUNK_LENGTH must be a power of two");
+
+	btlist<T*> chunks; // only the chunk pointers get copied when it grows
+	u4 length;
+
+	void set(GameMemory &memory, u4 max_chunks = 4, b4 use_transient = false)
+	{
+		length = 0;
+		chunks.set(memory, max_chunks, use_transient);
+	}
+
+	inline T& operator[](u4 index) const
+	{
+		return chunks[index / CHUNK_LENGTH][index & (CHUNK_LENGTH - 1)];
+	}
+	inline u4 size() const
+	{
+		return length;
+	}
+
+	inline u4 chunk_count() const
+	{
+		return (length + CHUNK_LENGTH - 1) / CHUNK_LENGTH;
+	}
+	inline T* chunk(u4 index) const
+	{
+		return chunks[index];
+	}
+	// every chunk is full except the last one
+	inline u4 chunk_length(u4 index) const
+	{
+		return index + 1 < chunk_count() ? CHUNK_LENGTH : length - index * CHUNK_LENGTH;
+	}
+
+	// Chunks are cache line aligned and kept by clear() for reuse
+	inline T* next_slot()
+	{
+		if (length == chunks.size() * CHUNK_LENGTH)
+		{
+			GameMemory &memory = *chunks.mem_arena;
+			u8 alignment = alignof(T) > B_CACHE_LINE_SIZE ? alignof(T) : B_CACHE_LINE_SIZE;
+			chunks.push(chunks.transient ? (T*)alloc_transient_aligned(memory, sizeof(T) * CHUNK_LENGTH, alignment)
+			                             : (T*)alloc_aligned(memory, sizeof(T) * CHUNK_LENGTH, alignment));
+		}
+		return &(*this)[length++];
+	}
+
+	inline T* push()
+	{
+		return new (next_slot()) T;
+	}
+	inline T* push(const T &item)
+	{
+		return new (next_slot()) T(item);
+	}
+	inline T* push(T &&item)
+	{
+		return new (next_slot()) T(std::move(item));
+	}
+
+	inline void pop()
+	{
+		length--;
+		(*this)[length].~T();
+	}
+	void clear()
+	{
+		if (!std::is_trivially_destructible<T>::value) {
+			for (u4 i = 0; i < length; i++) {
+				(*this)[i].~T();
+			}
+		}
+		length = 0;
+	}
+
+	// 0 when empty, there may not be a chunk yet
+	inline T* last()
+	{
+		return length > 0 ? &(*this)[length-1] : 0;
+	}
+};
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+template <typename... Fields>
+struct bsoa
+{
+	static const u4 COLUMNS = sizeof...(Fields);
+
+	template <u4 I>
+	using field = typename std::tuple_element<I, std::tuple<Fields...> >::type;
+
+	void* columns[COLUMNS];
+	u4 length;
+	u4 max_length;
+	GameMemory* mem_arena;
+	b4 transient;
+
+	void set(GameMemory &memory, u4 max, b4 use_transient = false)
+	{
+		length = 0;
+		max_length = 0;
+		mem_arena = &memory;
+		transient = use_transient;
+		for (u4 i = 0; i < COLUMNS; i++) {
+			columns[i] = 0;
+		}
+		reserve(max);
+	}
+
+	template <u4 I>
+	inline field<I>* column() const
+	{
+		return (field<I>*)columns[I];
+	}
+	inline u4 size() const
+	{
+		return length;
+	}
+
+	// Every column moves to a new cache line aligned block, old permanent ones are freed for reuse
+	void reserve(u4 max)
+	{
+		// columns are moved with memcpy, vec2 etc. are fine even with their own operator=
+		static_assert(all_trivial<Fields...>::value, "bsoa fields must be plain data");
+		if (max <= max_length) {
+			return;
+		}
+		const u8 sizes[] = { sizeof(Fields)... };
+		for (u4 i = 0; i < COLUMNS; i++)
+		{
+			void* mem_new = transient ? alloc_transient_aligned(*mem_arena, sizes[i] * max)
+			                          : alloc_aligned(*mem_arena, sizes[i] * max);
+			if (max_length) {
+				memcpy(mem_new, columns[i], sizes[i] * length);
+				if (!transient) {
+					free_block(*mem_arena, columns[i], sizes[i] * max_length);
+				}
+			}
+			columns[i] = mem_new;
+		}
+		max_length = max;
+	}
+
+	// Add a row, columns are left for the caller to fill. Returns its index.
+	inline u4 push()
+	{
+		if (length == max_length) {
+			reserve(max_length ? max_length * 2 : 16);
+		}
+		return length++;
+	}
+	inline u4 push(const Fields&... values)
+	{
+		u4 row = push();
+		write_row(row, 0, values...);
+		return row;
+	}
+
+	void resize(u4 new_length)
+	{
+		reserve(new_length);
+		length = new_length;
+	}
+	inline void clear()
+	{
+		length = 0;
+	}
+
+	// Move the last row into index. Doesn't keep order.
+	void swap_remove(u4 index)
+	{
+		const u8 sizes[] = { sizeof(Fields)... };
+		length--;
+		if (index != length) {
+			for (u4 i = 0; i < COLUMNS; i++) {
+				memcpy(((u1*)columns[i]) + sizes[i] * index, ((u1*)columns[i]) + sizes[i] * length, sizes[i]);
+			}
+		}
+	}
+
+private:
+	template <typename... Rest>
+	struct all_trivial : std::true_type {};
+	template <typename F, typename... Rest>
+	struct all_trivial<F, Rest...>
+		: std::integral_constant<bool, std::is_trivially_destructible<F>::value && all_trivial<Rest...>::value> {};
+
+	template <typename F, typename... Rest>
+	inline void write_row(u4 row, u4 col, const F &value, const Rest&... rest)
+	{
+		((F*)columns[col])[row] = value;
+		write_row(row, col + 1, rest...);
+	}
+	inline void write_row(u4, u4) {}
+};
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+// At most 2^20 (~1M) slots, insert() returns 0 past that. Oldest first
+// reuse spreads the 4095 generations over every free slot, so a handle
+// only aliases after that many reuses of its slot
+#define BSLOT_INDEX_BITS 20
+#define BSLOT_INDEX_MASK ((1u << BSLOT_INDEX_BITS) - 1)
+#define BSLOT_GENERATION_MASK (0xFFFFFFFFu >> BSLOT_INDEX_BITS)
+#define BSLOT_NONE 0xFFFFFFFFu
+
+typedef u4 bhandle;
+
+template <typename T>
+struct bslotmap
+{
+	struct Slot {
+		u4 dense;      // index into items, or next free slot
+		u4 generation; // never 0
+	};
+
+	btlist<T> items;     // live items, no holes
+	btlist<u4> owners;   // slot of each item, for fixing up on remove
+	btlist<Slot> slots;
+	u4 free_head;        // free slots in the order they were freed
+	u4 free_tail;
+
+	void set(GameMemory &memory, u4 max, b4 use_transient = false)
+	{
+		items.set(memory, max, use_transient);
+		owners.set(memory, max, use_transient);
+		slots.set(memory, max, use_transient);
+		free_head = BSLOT_NONE;
+		free_tail = BSLOT_NONE;
+	}
+
+	inline u4 size() const
+	{
+		return items.size();
+	}
+	inline T& operator[](u4 dense_index) const
+	{
+		return items[dense_index];
+	}
+
+	// Returns 0 once every slot index is taken
+	inline bhandle insert(const T &item)
+	{
+		u4 slot = free_head;
+		if (slot != BSLOT_NONE) {
+			free_head = slots[slot].dense;
+			if (free_head == BSLOT_NONE) {
+				free_tail = BSLOT_NONE;
+			}
+		} else {
+			slot = slots.size();
+			if (slot > BSLOT_INDEX_MASK) {
+				#ifdef MEM_DEBUG
+					std::cout << "ERROR: bslotmap is out of slot indices." << std::endl;
+				#endif
+				return 0;
+			}
+			Slot* fresh = slots.push();
+			fresh->generation = 1;
+		}
+		slots[slot].dense = items.size();
+		items.push(item);
+		owners.push(slot);
+		return make_handle(slot);
+	}
+
+	// Returns 0 if the handle was removed
+	inline T* get(bhandle handle) const
+	{
+		u4 slot = handle & BSLOT_INDEX_MASK;
+		if (slot >= slots.size() || slots[slot].generation != (handle >> BSLOT_INDEX_BITS)) {
+			return 0;
+		}
+		// a wrapped generation can match a free slot, whose dense is a free list link
+		u4 dense = slots[slot].dense;
+		if (dense >= items.size() || owners[dense] != slot) {
+			return 0;
+		}
+		return &items[dense];
+	}
+
+	// Moves the last item into the hole. Returns false for a stale handle.
+	b4 remove(bhandle handle)
+	{
+		if (!get(handle)) {
+			return false;
+		}
+		u4 slot = handle & BSLOT_INDEX_MASK;
+		u4 dense = slots[slot].dense;
+		u4 last = items.size() - 1;
+		if (dense != last) {
+			items[dense] = std::move(items[last]);
+			owners[dense] = owners[last];
+			slots[owners[dense]].dense = dense;
+		}
+		items.pop();
+		owners.pop();
+
+		bump_generation(slot);
+		free_slot(slot);
+		return true;
+	}
+
+	// Handle of the item at dense_index, for iterating and then removing
+	inline bhandle handle_of(u4 dense_index) const
+	{
+		return make_handle(owners[dense_index]);
+	}
+
+	void clear()
+	{
+		// bump every generation so old handles go stale
+		free_head = BSLOT_NONE;
+		free_tail = BSLOT_NONE;
+		for (u4 i = 0; i < slots.size(); i++) {
+			bump_generation(i);
+			free_slot(i);
+		}
+		items.clear();
+		owners.clear();
+	}
+
+private:
+	inline bhandle make_handle(u4 slot) const
+	{
+		return (slots[slot].generation << BSLOT_INDEX_BITS) | slot;
+	}
+
+	inline void bump_generation(u4 slot)
+	{
+		u4 generation = (slots[slot].generation + 1) & BSLOT_GENERATION_MASK;
+		slots[slot].generation = generation ? generation : 1;
+	}
+
+	// Append to the back so a slot waits for every other free slot before reuse
+	inline void free_slot(u4 slot)
+	{
+		slots[slot].dense = BSLOT_NONE;
+		if (free_tail != BSLOT_NONE) {
+			slots[free_tail].dense = slot;
+		} else {
+			free_head = slot;
+		}
+		free_tail = slot;
+	}
+};
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+// capacity is rounded up to a power of two, indices wrap at 2^32
+inline u4 bring_capacity(u4 capacity)
+{
+	u4 size = 2;
+	while (size < capacity) {
+		size *= 2;
+	}
+	return size;
+}
+
+// single producer, single consumer
+template <typename T>
+struct bspsc
+{
+	T* items;
+	u4 mask;
+
+	// each side caches the other side's index so it only reads the shared
+	// line when it looks full / empty
+	B_CACHE_ALIGNED std::atomic<u4> head; // next to pop, written by the consumer
+	u4 cached_tail;
+	B_CACHE_ALIGNED std::atomic<u4> tail; // next to push, written by the producer
+	u4 cached_head;
+
+	void set(GameMemory &memory, u4 capacity)
+	{
+		capacity = bring_capacity(capacity);
+		items = (T*)alloc_aligned(memory, sizeof(T) * capacity);
+		mask = capacity - 1;
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		cached_head = 0;
+		cached_tail = 0;
+	}
+
+	// Producer. Returns how many were pushed.
+	u4 push(const T* in, u4 count)
+	{
+		u4 t = tail.load(std::memory_order_relaxed);
+		if (mask + 1 - (t - cached_head) < count) {
+			cached_head = head.load(std::memory_order_acquire);
+		}
+		u4 room = mask + 1 - (t - cached_head);
+		if (count > room) {
+			count = room;
+		}
+		for (u4 i = 0; i < count; i++) {
+			items[(t + i) & mask] = in[i];
+		}
+		tail.store(t + count, std::memory_order_release);
+		return count;
+	}
+	inline b4 push(const T &item)
+	{
+		return push(&item, 1) == 1;
+	}
+
+	// Consumer. Returns how many were popped.
+	u4 pop(T* out, u4 max)
+	{
+		u4 h = head.load(std::memory_order_relaxed);
+		if (cached_tail - h < max) {
+			cached_tail = tail.load(std::memory_order_acquire);
+		}
+		u4 count = cached_tail - h;
+		if (count > max) {
+			count = max;
+		}
+		for (u4 i = 0; i < count; i++) {
+			out[i] = items[(h + i) & mask];
+		}
+		head.store(h + count, std::memory_order_release);
+		return count;
+	}
+	inline b4 pop(T &item)
+	{
+		return pop(&item, 1) == 1;
+	}
+};
+
+/*
+	multiple producers, single consumer
+	Each cell carries a sequence number: producers claim cells by CAS on
+	tail, then publish them by bumping the sequence, so the consumer never
+	reads a half written cell.
+*/
+template <typename T>
+struct bmpsc
+{
+	struct Cell {
+		std::atomic<u4> sequence;
+		T item;
+	};
+
+	Cell* cells;
+	u4 mask;
+
+	B_CACHE_ALIGNED std::atomic<u4> tail; // next to claim, shared by the producers
+	B_CACHE_ALIGNED u4 head;              // next to pop, consumer only
+
+	void set(GameMemory &memory, u4 capacity)
+	{
+		capacity = bring_capacity(capacity);
+		cells = (Cell*)alloc_aligned(memory, sizeof(Cell) * capacity);
+		for (u4 i = 0; i < capacity; i++) {
+			new (&cells[i].sequence) std::atomic<u4>(i);
+		}
+		mask = capacity - 1;
+		tail.store(0, std::memory_order_relaxed);
+		head = 0;
+	}
+
+	// Any producer. All or nothing, returns count or 0 if there isn't room for all of them.
+	u4 push(const T* in, u4 count)
+	{
+		if (count == 0 || count > mask + 1) {
+			return 0;
+		}
+		u4 pos = tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			// cells are freed in order, so if the last one is free they all are
+			Cell &last = cells[(pos + count - 1) & mask];
+			s4 diff = (s4)(last.sequence.load(std::memory_order_acquire) - (pos + count - 1));
+			if (diff == 0) {
+				if (tail.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return 0;
+			} else {
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+		for (u4 i = 0; i < count; i++) {
+			Cell &cell = cells[(pos + i) & mask];
+			cell.item = in[i];
+			cell.sequence.store(pos + i + 1, std::memory_order_release);
+		}
+		return count;
+	}
+	inline b4 push(const T &item)
+	{
+		return push(&item, 1) == 1;
+	}
+
+	// Consumer. Stops at the first cell that isn't published yet.
+	u4 pop(T* out, u4 max)
+	{
+		u4 count = 0;
+		while (count < max)
+		{
+			Cell &cell = cells[head & mask];
+			if (cell.sequence.load(std::memory_order_acquire) != head + 1) {
+				break;
+			}
+			out[count++] = cell.item;
+			cell.sequence.store(head + mask + 1, std::memory_order_release);
+			head++;
+		}
+		return count;
+	}
+	inline b4 pop(T &item)
+	{
+		return pop(&item, 1) == 1;
+	}
+};
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+template <typename T, u4 N>
+struct bsmall
+{
+	u4 length;
+	u4 max_length;
+	T* heap; // 0 while the items fit inline
+	GameMemory* mem_arena;
+	b4 transient;
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type storage[N];
+
+	void set(GameMemory &memory, b4 use_transient = false)
+	{
+		length = 0;
+		max_length = N;
+		heap = 0;
+		mem_arena = &memory;
+		transient = use_transient;
+	}
+
+	inline T* data() const
+	{
+		return heap ? heap : (T*)storage;
+	}
+	inline T& operator[](u4 index) const
+	{
+		return data()[index];
+	}
+	inline u4 size() const
+	{
+		return length;
+	}
+	inline T* begin() const
+	{
+		return data();
+	}
+	inline T* end() const
+	{
+		return data() + length;
+	}
+
+	// Move everything to a bigger arena block, old permanent blocks are freed for reuse
+	void spill()
+	{
+		uint64_t new_size = (uint64_t)sizeof(T) * max_length * 2;
+		T* mem_new;
+		if (transient) {
+			mem_new = (T*)alloc_transient_aligned(*mem_arena, new_size, alignof(T));
+		} else if (alignof(T) <= B_BLOCK_ALIGNMENT) {
+			mem_new = (T*)alloc_block(*mem_arena, new_size);
+		} else {
+			mem_new = (T*)alloc_aligned(*mem_arena, new_size, alignof(T));
+		}
+		T* items = data();
+		for (u4 i = 0; i < length; i++) {
+			new (&mem_new[i]) T(std::move(items[i]));
+			items[i].~T();
+		}
+		if (heap && !transient) {
+			free_block(*mem_arena, heap, (uint64_t)sizeof(T) * max_length);
+		}
+		heap = mem_new;
+		max_length = (u4)(new_size / sizeof(T));
+	}
+
+	inline T* push()
+	{
+		if (length == max_length) {
+			spill();
+		}
+		return new (&data()[length++]) T;
+	}
+	inline T* push(const T &item)
+	{
+		if (length == max_length) {
+			// item may be one of our own, spill() moves it before freeing the old block
+			T* items = data();
+			u4 own = &item >= items && &item < items + length ? (u4)(&item - items) : length;
+			spill();
+			if (own != length) {
+				return new (&data()[length++]) T(data()[own]);
+			}
+		}
+		return new (&data()[length++]) T(item);
+	}
+	inline T* push(T &&item)
+	{
+		if (length == max_length) {
+			T* items = data();
+			u4 own = &item >= items && &item < items + length ? (u4)(&item - items) : length;
+			spill();
+			if (own != length) {
+				return new (&data()[length++]) T(std::move(data()[own]));
+			}
+		}
+		return new (&data()[length++]) T(std::move(item));
+	}
+
+	inline void pop()
+	{
+		length--;
+		data()[length].~T();
+	}
+	void clear()
+	{
+		if (!std::is_trivially_destructible<T>::value) {
+			for (u4 i = 0; i < length; i++) {
+				data()[i].~T();
+			}
+		}
+		length = 0;
+	}
+
+	inline T* last()
+	{
+		return length > 0 ? &data()[length-1] : data();
+	}
+};
+
 #endif
\ No newline at end of file
@@ -5,6 +5,18 @@
 #include <cstring>      /* memset */ 
 #include <stdint.h>
 
+#if defined(_WIN32)
+#include <windows.h>    /* VirtualAlloc */
+#include <stdio.h>      /* fopen */
+#else
+#include <stdio.h>      /* fopen, rename */
+#include <sys/mman.h>   /* mmap, mprotect, madvise */
+#include <sys/wait.h>   /* waitpid */
+#include <fcntl.h>      /* open */
+#include <sys/stat.h>   /* fstat */
+#include <unistd.h>     /* fork, write */
+#endif
+
 #define domestic static
 #define global_variable static
 #define local_persist static
@@ -43,7 +55,46 @@ typedef double d64;
 
 #define MEM_DEBUG
 
-struct GameMemory
+// fetch-add on a uint64_t cursor, returns the old value
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define B_ATOMIC_ADD_U8(PTR, N) ((uint64_t)_InterlockedExchangeAdd64((volatile long long*)(PTR), (long long)(N)))
+#define B_ATOMIC_LOAD_U8(PTR) ((uint64_t)_InterlockedOr64((volatile long long*)(PTR), 0))
+#define B_ATOMIC_CAS_U8(PTR, EXPECTED, DESIRED) \
+    ((uint64_t)_InterlockedCompareExchange64((volatile long long*)(PTR), (long long)(DESIRED), (long long)(EXPECTED)) == (EXPECTED))
+#else
+#define B_ATOMIC_ADD_U8(PTR, N) __atomic_fetch_add((PTR), (uint64_t)(N), __ATOMIC_RELAXED)
+#define B_ATOMIC_LOAD_U8(PTR) __atomic_load_n((PTR), __ATOMIC_RELAXED)
+#define B_ATOMIC_CAS_U8(PTR, EXPECTED, DESIRED) \
+    ({ uint64_t b_expected_ = (EXPECTED); __atomic_compare_exchange_n((PTR), &b_expected_, (uint64_t)(DESIRED), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED); })
+#endif
+
+#ifndef B_CACHE_LINE_SIZE
+#define B_CACHE_LINE_SIZE 64
+#endif
+
+// put on hot structs that are written by different threads
+#define B_CACHE_ALIGNED alignas(B_CACHE_LINE_SIZE)
+
+// alignment of blocks from alloc_block(), so any block can be reused for any list
+#ifndef B_BLOCK_ALIGNMENT
+#define B_BLOCK_ALIGNMENT 16
+#endif
+#define MEM_BLOCK_CLASSES 64
+
+#ifndef B_PAGE_SIZE
+#define B_PAGE_SIZE Kilobytes(4)
+#endif
+
+// granularity virtual arenas grow by, matches a 2MB hugepage
+#ifndef B_MEMORY_COMMIT_SIZE
+#define B_MEMORY_COMMIT_SIZE Megabytes(2)
+#endif
+
+struct MemoryStats;
+
+// cache line aligned so per-thread arenas never share a line
+struct alignas(B_CACHE_LINE_SIZE) GameMemory
 {
     b4  isInitialized;
     uint64_t  PermanentStorageSize;
@@ -53,27 +104,325 @@ struct GameMemory
     uint64_t  TransientStorageSize;
     void* TransientStorage;
     uint64_t  transient_current;  
+
+    // address space reserved by initialize_memory_virtual(), 0 for malloc
+    uint64_t  PermanentReserveSize;
+    uint64_t  TransientReserveSize;
+
+    // per-thread slices of TransientStorage, see init_thread_arenas()
+    GameMemory* thread_arenas;
+    u4  thread_arena_count;
+
+    // other half of transient storage, see init_transient_double_buffer()
+    void* TransientPrevious;
+    uint64_t  transient_previous_used;
+
+    // open begin_temporary_memory() savepoints
+    u4  temp_count;
+
+    // freed permanent blocks by power-of-two size class, see alloc_block()
+    void* free_blocks[MEM_BLOCK_CLASSES];
+
+    // allocation telemetry, see set_memory_tag() and memory_frame_stats()
+    MemoryStats* stats;
+    u4  tag;
 };
 
 global_variable GameMemory memory;
 
+/*
+    Virtual memory backend.
+    Reserve a range of address space up front and commit pages as they are
+    needed. Committed pages are zeroed by the kernel on first touch, so
+    nothing has to be memset and untouched pages never cost physical memory.
+    A non-zero base asks for exactly that address and fails (returns 0)
+    rather than take another one or replace an existing mapping.
+*/
+void* reserve_pages(uint64_t size, b4 huge_pages = false, void* base = 0)
+{
+#if defined(_WIN32)
+    return VirtualAlloc(base, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    #ifdef MAP_FIXED_NOREPLACE
+        if (base) {
+            flags |= MAP_FIXED_NOREPLACE;
+        }
+    #endif
+    void* mem = mmap(base, size, PROT_NONE, flags, -1, 0);
+    if (mem == MAP_FAILED) {
+        return 0;
+    }
+    // older kernels take base only as a hint
+    if (base && mem != base) {
+        munmap(mem, size);
+        return 0;
+    }
+    #ifdef MADV_HUGEPAGE
+        if (huge_pages) {
+            madvise(mem, size, MADV_HUGEPAGE);
+        }
+    #endif
+    return mem;
+#endif
+}
+
+// Make reserved pages readable and writable
+b4 commit_pages(void* start, uint64_t size)
+{
+#if defined(_WIN32)
+    return VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) != 0;
+#else
+    return mprotect(start, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+// Zero memory by handing whole pages back to the kernel, memset the ragged ends
+void zero_pages(void* start, uint64_t size)
+{
+    uintptr_t begin = (uintptr_t)start;
+    uintptr_t end = begin + size;
+    uintptr_t first = (begin + B_PAGE_SIZE - 1) & ~((uintptr_t)B_PAGE_SIZE - 1);
+    uintptr_t last = end & ~((uintptr_t)B_PAGE_SIZE - 1);
+    if (last <= first) {
+        memset(start,0,size);
+        return;
+    }
+    memset(start,0,first - begin);
+#if defined(_WIN32)
+    VirtualFree((void*)first, last - first, MEM_DECOMMIT);
+    VirtualAlloc((void*)first, last - first, MEM_COMMIT, PAGE_READWRITE);
+#else
+    madvise((void*)first, last - first, MADV_DONTNEED);
+#endif
+    memset((void*)last,0,end - last);
+}
+
+// zero_pages() for ranges that may be file mapped: MADV_DONTNEED would
+// reload the file, so whole pages get a fresh anonymous mapping instead
+void zero_mapped_pages(void* start, uint64_t size)
+{
+#if defined(_WIN32)
+    zero_pages(start, size);
+#else
+    uintptr_t begin = (uintptr_t)start;
+    uintptr_t end = begin + size;
+    uintptr_t first = (begin + B_PAGE_SIZE - 1) & ~((uintptr_t)B_PAGE_SIZE - 1);
+    uintptr_t last = end & ~((uintptr_t)B_PAGE_SIZE - 1);
+    if (last <= first) {
+        memset(start,0,size);
+        return;
+    }
+    memset(start,0,first - begin);
+    mmap((void*)first, last - first, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    memset((void*)last,0,end - last);
+#endif
+}
+
+/*
+    Commit more of the reserved permanent range so [0, needed) is usable.
+    Pointers never move. Safe to call from several threads: committing a
+    page twice is harmless and the committed size only ever grows.
+*/
+b4 grow_permanent(GameMemory &memory, uint64_t needed)
+{
+    if (needed > memory.PermanentReserveSize) {
+        #ifdef MEM_DEBUG
+            std::cout << "ERROR: Permanent memory reserve exhausted." << std::endl;
+        #endif
+        return false;
+    }
+    uint64_t committed = B_ATOMIC_LOAD_U8(&memory.PermanentStorageSize);
+    if (needed <= committed) {
+        return true;
+    }
+    uint64_t new_size = (needed + B_MEMORY_COMMIT_SIZE - 1) & ~((uint64_t)B_MEMORY_COMMIT_SIZE - 1);
+    if (new_size > memory.PermanentReserveSize) {
+        new_size = memory.PermanentReserveSize;
+    }
+    if (!commit_pages(((u1*)memory.PermanentStorage) + committed, new_size - committed)) {
+        return false;
+    }
+    while (committed < new_size && !B_ATOMIC_CAS_U8(&memory.PermanentStorageSize, committed, new_size)) {
+        committed = B_ATOMIC_LOAD_U8(&memory.PermanentStorageSize);
+    }
+    return true;
+}
+
+/*
+    Allocation telemetry.
+    alloc() and alloc_transient() count into the tag set with
+    set_memory_tag(), a log2 size histogram and the frame's transient peak.
+    Emptying transient memory ends the frame and pushes it into a ring
+    buffer of the last MEM_STATS_FRAMES frames.
+    Cheap enough to leave on; define MEM_NO_STATS to compile it out.
+    Atomic allocations and thread arenas are not counted, only the
+    largest thread arena cursor at frame end.
+*/
+#ifndef MEM_STATS_TAGS
+#define MEM_STATS_TAGS 16
+#endif
+#ifndef MEM_STATS_FRAMES
+#define MEM_STATS_FRAMES 64
+#endif
+#define MEM_STATS_BUCKETS 64
+
+struct MemoryTagStats
+{
+    const char* name;
+    uint64_t bytes;
+    u4 count;
+};
+
+struct MemoryFrameStats
+{
+    uint64_t permanent_used;
+    uint64_t transient_peak;
+    uint64_t thread_arena_peak;
+    u4 alloc_count;
+};
+
+struct MemoryStats
+{
+    MemoryTagStats tags[MEM_STATS_TAGS];
+    u4 size_histogram[MEM_STATS_BUCKETS]; // allocations by floor(log2(size))
+    uint64_t transient_peak;              // highest transient_current ever
+    MemoryFrameStats frame;               // frame in progress
+    MemoryFrameStats frames[MEM_STATS_FRAMES];
+    u4 frame_count;
+};
+
+inline u4 b_log2(uint64_t n)
+{
+    if (n == 0) {
+        return 0;
+    }
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, n);
+    return (u4)index;
+#else
+    return 63 - (u4)__builtin_clzll(n);
+#endif
+}
+
+inline void record_alloc(GameMemory &memory, uint64_t n)
+{
+#ifndef MEM_NO_STATS
+    MemoryStats* stats = memory.stats;
+    if (!stats) {
+        return;
+    }
+    stats->tags[memory.tag].bytes += n;
+    stats->tags[memory.tag].count++;
+    stats->size_histogram[b_log2(n)]++;
+    stats->frame.alloc_count++;
+#endif
+}
+
+inline void record_alloc_transient(GameMemory &memory, uint64_t n)
+{
+#ifndef MEM_NO_STATS
+    record_alloc(memory, n);
+    if (memory.stats && memory.transient_current > memory.stats->frame.transient_peak) {
+        memory.stats->frame.transient_peak = memory.transient_current;
+    }
+#endif
+}
+
+// Close the frame in progress and push it into the history
+void end_stats_frame(GameMemory &memory)
+{
+    MemoryStats* stats = memory.stats;
+    if (!stats) {
+        return;
+    }
+    MemoryFrameStats &frame = stats->frame;
+    frame.permanent_used = memory.current;
+    for (u4 i = 0; i < memory.thread_arena_count; i++) {
+        if (memory.thread_arenas[i].transient_current > frame.thread_arena_peak) {
+            frame.thread_arena_peak = memory.thread_arenas[i].transient_current;
+        }
+    }
+    if (frame.transient_peak > stats->transient_peak) {
+        stats->transient_peak = frame.transient_peak;
+    }
+    stats->frames[stats->frame_count % MEM_STATS_FRAMES] = frame;
+    stats->frame_count++;
+    frame = {};
+}
+
+// Allocations made after this are counted under tag, out of range tags count as the last one
+inline void set_memory_tag(GameMemory &memory, u4 tag, const char* name = 0)
+{
+    if (tag >= MEM_STATS_TAGS) {
+        #ifdef MEM_DEBUG
+            std::cout << "ERROR: Memory tag " << tag << " is past MEM_STATS_TAGS." << std::endl;
+        #endif
+        tag = MEM_STATS_TAGS - 1;
+    }
+    memory.tag = tag;
+    if (name && memory.stats) {
+        memory.stats->tags[tag].name = name;
+    }
+}
+
+struct MemoryTagScope
+{
+    GameMemory* memory;
+    u4 previous;
+
+    MemoryTagScope(GameMemory &memory, u4 tag, const char* name = 0) : memory(&memory), previous(memory.tag)
+    {
+        set_memory_tag(memory, tag, name);
+    }
+    ~MemoryTagScope() { memory->tag = previous; }
+};
+
+// Stats for a finished frame, 0 is the last one. Returns 0 if not recorded.
+inline const MemoryFrameStats* memory_frame_stats(GameMemory &memory, u4 frames_ago = 0)
+{
+    MemoryStats* stats = memory.stats;
+    if (!stats || frames_ago >= stats->frame_count || frames_ago >= MEM_STATS_FRAMES) {
+        return 0;
+    }
+    return &stats->frames[(stats->frame_count - 1 - frames_ago) % MEM_STATS_FRAMES];
+}
+
 // Empty transient memory AND zero out storage
 inline void empty_transient(GameMemory &memory)
 {
-    memset(memory.TransientStorage,0,memory.TransientStorageSize);
+    end_stats_frame(memory);
+    if (memory.TransientReserveSize) {
+        zero_pages(memory.TransientStorage,memory.TransientStorageSize);
+    } else {
+        memset(memory.TransientStorage,0,memory.TransientStorageSize);
+    }
     memory.transient_current = 0;
+    for (u4 i = 0; i < memory.thread_arena_count; i++) {
+        empty_transient(memory.thread_arenas[i]);
+    }
 } 
 
 // Empty transient memory without zeroing storage
 inline void empty_transient_soft(GameMemory &memory)
 { 
+    end_stats_frame(memory);
     memory.transient_current = 0;
+    for (u4 i = 0; i < memory.thread_arena_count; i++) {
+        memory.thread_arenas[i].transient_current = 0;
+    }
 } 
 
 // Allocate permanent memory
 void* alloc(GameMemory &memory, uint64_t n)
 {
     memory.current += n;
+    if (memory.current > memory.PermanentStorageSize && memory.PermanentReserveSize) {
+        grow_permanent(memory, memory.current);
+    }
+    record_alloc(memory, n);
     // cast to unsigned byte so i can increment it by single bytes
     return ( ((u1*)memory.PermanentStorage) + memory.current - n);
 } 
@@ -82,10 +431,604 @@ void* alloc(GameMemory &memory, uint64_t n)
 void* alloc_transient(GameMemory &memory, std::size_t n)
 {
     memory.transient_current += n;
+    record_alloc_transient(memory, n);
     // std::cout << memory.transient_current << std::endl;
     return ( ((u1*)memory.TransientStorage) + memory.transient_current - n);
 }  
 
+/*
+    Thread-safe versions of alloc() / alloc_transient().
+    The cursor is advanced with a single atomic fetch-add, so concurrent
+    callers always get disjoint bytes. Virtual arenas grow as usual.
+    Returns 0 when the block runs out. The failed bytes are given back if
+    nobody allocated after them, otherwise the cursor is pulled back to the
+    end of the block, so the block reads as full. It never goes below the
+    failed start: an earlier caller may still be growing a virtual arena
+    for a block that ends past the committed size.
+    Don't mix with the plain versions while other threads are allocating.
+*/
+inline void release_atomic_overflow(uint64_t* cursor, uint64_t start, uint64_t n, uint64_t size)
+{
+    if (B_ATOMIC_CAS_U8(cursor, start + n, start)) {
+        return;
+    }
+    // later callers that also overflowed only ever move it further out
+    uint64_t lowest = start > size ? start : size;
+    uint64_t current = B_ATOMIC_LOAD_U8(cursor);
+    while (current > lowest && !B_ATOMIC_CAS_U8(cursor, current, lowest)) {
+        current = B_ATOMIC_LOAD_U8(cursor);
+    }
+}
+
+void* alloc_atomic(GameMemory &memory, uint64_t n)
+{
+    uint64_t start = B_ATOMIC_ADD_U8(&memory.current, n);
+    if (start + n > B_ATOMIC_LOAD_U8(&memory.PermanentStorageSize)
+        && !(memory.PermanentReserveSize && grow_permanent(memory, start + n)))
+    {
+        release_atomic_overflow(&memory.current, start, n, B_ATOMIC_LOAD_U8(&memory.PermanentStorageSize));
+        return 0;
+    }
+    return ((u1*)memory.PermanentStorage) + start;
+}
+
+void* alloc_transient_atomic(GameMemory &memory, uint64_t n)
+{
+    uint64_t start = B_ATOMIC_ADD_U8(&memory.transient_current, n);
+    if (start + n > memory.TransientStorageSize) {
+        release_atomic_overflow(&memory.transient_current, start, n, memory.TransientStorageSize);
+        return 0;
+    }
+    return ((u1*)memory.TransientStorage) + start;
+}
+
+/*
+    Aligned allocation. alignment must be a power of two, defaults to a cache
+    line. Use 16/32 for SSE/AVX data. Padding is taken from the arena.
+    The atomic versions over-allocate by alignment - 1 since the cursor
+    isn't known before the fetch-add.
+*/
+inline uint64_t align_padding(void* base, uint64_t offset, uint64_t alignment)
+{
+    uintptr_t cursor = (uintptr_t)base + offset;
+    return ((cursor + alignment - 1) & ~((uintptr_t)alignment - 1)) - cursor;
+}
+
+void* alloc_aligned(GameMemory &memory, uint64_t n, uint64_t alignment = B_CACHE_LINE_SIZE)
+{
+    uint64_t padding = align_padding(memory.PermanentStorage, memory.current, alignment);
+    return ((u1*)alloc(memory, padding + n)) + padding;
+}
+
+void* alloc_transient_aligned(GameMemory &memory, uint64_t n, uint64_t alignment = B_CACHE_LINE_SIZE)
+{
+    uint64_t padding = align_padding(memory.TransientStorage, memory.transient_current, alignment);
+    return ((u1*)alloc_transient(memory, padding + n)) + padding;
+}
+
+void* alloc_atomic_aligned(GameMemory &memory, uint64_t n, uint64_t alignment = B_CACHE_LINE_SIZE)
+{
+    u1* mem = (u1*)alloc_atomic(memory, n + alignment - 1);
+    if (!mem) {
+        return 0;
+    }
+    return mem + align_padding(mem, 0, alignment);
+}
+
+void* alloc_transient_atomic_aligned(GameMemory &memory, uint64_t n, uint64_t alignment = B_CACHE_LINE_SIZE)
+{
+    u1* mem = (u1*)alloc_transient_atomic(memory, n + alignment - 1);
+    if (!mem) {
+        return 0;
+    }
+    return mem + align_padding(mem, 0, alignment);
+}
+
+/*
+    Resizable blocks, for containers that grow (blist, btlist).
+    grow_in_place() extends a block that sits at the top of its arena.
+    Otherwise the container takes a new block from alloc_block() and hands
+    the old one to free_block(). Freed permanent blocks go on a free list
+    per power-of-two size class and are reused by the next block of that
+    class. Transient blocks are ignored, they go away on the next reset.
+*/
+inline b4 grow_in_place(GameMemory &memory, void* block, uint64_t old_size, uint64_t new_size)
+{
+    u1* end = (u1*)block + old_size;
+    if (end == ((u1*)memory.PermanentStorage) + memory.current) {
+        alloc(memory, new_size - old_size);
+        return true;
+    }
+    if (end == ((u1*)memory.TransientStorage) + memory.transient_current) {
+        alloc_transient(memory, new_size - old_size);
+        return true;
+    }
+    return false;
+}
+
+// n is rounded up to the size of the block handed out
+void* alloc_block(GameMemory &memory, uint64_t &n)
+{
+    if (n < sizeof(void*)) {
+        n = sizeof(void*);
+    }
+    u4 size_class = b_log2(n - 1) + 1;
+    n = (uint64_t)1 << size_class;
+    void* block = memory.free_blocks[size_class];
+    if (block) {
+        memory.free_blocks[size_class] = *(void**)block;
+        return block;
+    }
+    return alloc_aligned(memory, n, B_BLOCK_ALIGNMENT);
+}
+
+void free_block(GameMemory &memory, void* block, uint64_t n)
+{
+    u1* start = (u1*)block;
+    u1* permanent = (u1*)memory.PermanentStorage;
+    if (start < permanent || start >= permanent + memory.PermanentStorageSize) {
+        return;
+    }
+    // blocks from plain alloc() may be misaligned, trim them
+    uint64_t padding = align_padding(start, 0, B_BLOCK_ALIGNMENT);
+    if (n < padding + sizeof(void*)) {
+        return;
+    }
+    start += padding;
+    u4 size_class = b_log2(n - padding);
+    *(void**)start = memory.free_blocks[size_class];
+    memory.free_blocks[size_class] = start;
+}
+
+/*
+    Per-thread transient arenas.
+    Carves count slices off the end of TransientStorage. Each slice is a
+    GameMemory with only transient storage, so alloc_transient() works on it
+    unchanged and each thread bumps its own cursor without locks.
+    Slices start on a cache line and are rounded to whole lines so threads
+    never share a line.
+    empty_transient() / empty_transient_soft() on the parent resets all slices.
+    Returns false and changes nothing if the slices don't fit.
+*/
+b4 init_thread_arenas(GameMemory &memory, u4 count, uint64_t bytes_per_thread)
+{
+    bytes_per_thread = (bytes_per_thread + B_CACHE_LINE_SIZE - 1) & ~((uint64_t)B_CACHE_LINE_SIZE - 1);
+    uint64_t total = bytes_per_thread * count;
+    // carve at a cache line boundary in absolute terms, the block itself may not be aligned
+    uintptr_t base = (uintptr_t)memory.TransientStorage;
+    uintptr_t end = base + memory.TransientStorageSize;
+    if (total > end - base - memory.transient_current
+        || ((end - total) & ~((uintptr_t)B_CACHE_LINE_SIZE - 1)) < base + memory.transient_current) {
+        #ifdef MEM_DEBUG
+            std::cout << "ERROR: Not enough transient memory for thread arenas." << std::endl;
+        #endif
+        return false;
+    }
+
+    u1* slice = (u1*)((end - total) & ~((uintptr_t)B_CACHE_LINE_SIZE - 1));
+    memory.TransientStorageSize = (uint64_t)((uintptr_t)slice - base);
+
+    memory.thread_arenas = (GameMemory*)alloc_aligned(memory, sizeof(GameMemory) * count);
+    memory.thread_arena_count = count;
+    for (u4 i = 0; i < count; i++)
+    {
+        GameMemory* arena = &memory.thread_arenas[i];
+        *arena = {};
+        arena->isInitialized = true;
+        arena->TransientStorageSize = bytes_per_thread;
+        arena->TransientStorage = slice + bytes_per_thread * i;
+        arena->transient_current = 0;
+    }
+    return true;
+}
+
+/*
+    Double buffered transient memory.
+    Splits the shared transient block into two halves. flip_transient() at
+    the end of the frame swaps them, so everything allocated during frame N
+    stays valid through frame N+1 (last frame's quadtree, interpolation
+    data) and is reclaimed when its half comes around again in N+2.
+    Thread arenas are not double buffered.
+*/
+void init_transient_double_buffer(GameMemory &memory)
+{
+    uint64_t half = (memory.TransientStorageSize / 2) & ~((uint64_t)B_PAGE_SIZE - 1);
+    memory.TransientStorageSize = half;
+    memory.TransientPrevious = ((u1*)memory.TransientStorage) + half;
+    memory.transient_previous_used = 0;
+}
+
+// End the frame: this frame's memory becomes the previous one, the old previous one is emptied
+void flip_transient(GameMemory &memory, b4 zero_storage = false)
+{
+    void* previous = memory.TransientStorage;
+    memory.TransientStorage = memory.TransientPrevious;
+    memory.TransientPrevious = previous;
+    memory.transient_previous_used = memory.transient_current;
+    if (zero_storage) {
+        empty_transient(memory);
+    } else {
+        empty_transient_soft(memory);
+    }
+}
+
+/*
+    Temporary memory.
+    Savepoint on the transient cursor, so scratch memory can be given back as
+    soon as it isn't needed instead of at the end of the frame.
+    Savepoints nest and must be ended in reverse order.
+
+        TemporaryMemory temp = begin_temporary_memory(memory);
+        void* scratch = alloc_transient(memory, n);
+        end_temporary_memory(temp);
+
+    or let TemporaryScope end it when it goes out of scope.
+*/
+struct TemporaryMemory
+{
+    GameMemory* memory;
+    uint64_t transient_current;
+    u4 depth;
+};
+
+inline TemporaryMemory begin_temporary_memory(GameMemory &memory)
+{
+    TemporaryMemory temp;
+    temp.memory = &memory;
+    temp.transient_current = memory.transient_current;
+    temp.depth = ++memory.temp_count;
+    return temp;
+}
+
+inline void end_temporary_memory(TemporaryMemory temp)
+{
+    GameMemory &memory = *temp.memory;
+    #ifdef MEM_DEBUG
+        if (temp.depth != memory.temp_count || memory.transient_current < temp.transient_current) {
+            std::cout << "ERROR: Temporary memory ended out of order." << std::endl;
+        }
+    #endif
+    memory.transient_current = temp.transient_current;
+    memory.temp_count--;
+}
+
+struct TemporaryScope
+{
+    TemporaryMemory temp;
+
+    TemporaryScope(GameMemory &memory) : temp(begin_temporary_memory(memory)) {}
+    ~TemporaryScope() { end_temporary_memory(temp); }
+};
+
+/*
+    Memory pool.
+    Fixed size slots carved from permanent memory in blocks of
+    slots_per_block. Freed slots go on an intrusive free list and are handed
+    out again first, so alloc and free are O(1) and never fragment.
+    Slot contents are not cleared on reuse.
+*/
+struct MemoryPool
+{
+    GameMemory* mem_arena;
+    void* free_list;
+    uint64_t slot_size;
+    uint64_t alignment;
+    u4 slots_per_block;
+    u4 capacity; // slots carved so far
+    u4 used;     // slots handed out
+};
+
+void pool_set(MemoryPool &pool, GameMemory &memory, uint64_t slot_size, u4 slots_per_block,
+              uint64_t alignment = sizeof(void*))
+{
+    if (slot_size < sizeof(void*)) {
+        slot_size = sizeof(void*);
+    }
+    pool.mem_arena = &memory;
+    pool.free_list = 0;
+    pool.slot_size = (slot_size + alignment - 1) & ~(alignment - 1);
+    pool.alignment = alignment;
+    pool.slots_per_block = slots_per_block;
+    pool.capacity = 0;
+    pool.used = 0;
+}
+
+// Carve another block of slots and put them on the free list
+void pool_grow(MemoryPool &pool)
+{
+    u1* block = (u1*)alloc_aligned(*pool.mem_arena, pool.slot_size * pool.slots_per_block, pool.alignment);
+    // link back to front so slots are handed out in address order
+    for (u4 i = pool.slots_per_block; i > 0; i--)
+    {
+        void* slot = block + pool.slot_size * (i - 1);
+        *(void**)slot = pool.free_list;
+        pool.free_list = slot;
+    }
+    pool.capacity += pool.slots_per_block;
+}
+
+inline void* pool_alloc(MemoryPool &pool)
+{
+    if (!pool.free_list) {
+        pool_grow(pool);
+    }
+    void* slot = pool.free_list;
+    pool.free_list = *(void**)slot;
+    pool.used++;
+    return slot;
+}
+
+inline void pool_free(MemoryPool &pool, void* slot)
+{
+    *(void**)slot = pool.free_list;
+    pool.free_list = slot;
+    pool.used--;
+}
+
+// Fill out with count slots
+void pool_alloc_batch(MemoryPool &pool, void** out, u4 count)
+{
+    while (pool.capacity - pool.used < count) {
+        pool_grow(pool);
+    }
+    void* slot = pool.free_list;
+    for (u4 i = 0; i < count; i++)
+    {
+        out[i] = slot;
+        slot = *(void**)slot;
+    }
+    pool.free_list = slot;
+    pool.used += count;
+}
+
+// Chain the slots together first, then splice them onto the free list once
+void pool_free_batch(MemoryPool &pool, void** slots, u4 count)
+{
+    if (count == 0) {
+        return;
+    }
+    for (u4 i = 0; i + 1 < count; i++)
+    {
+        *(void**)slots[i] = slots[i + 1];
+    }
+    *(void**)slots[count - 1] = pool.free_list;
+    pool.free_list = slots[0];
+    pool.used -= count;
+}
+
+/*
+    Permanent storage snapshots.
+    All game state lives in PermanentStorage, so the whole world is saved
+    and restored as one block instead of serializing objects.
+    Pointers inside the block are absolute: a snapshot only restores into
+    storage at the same address it was saved from. In the same process
+    that is any arena (level restarts, replay checkpoints); for crash
+    recovery in a new process pass the same permanent_base to
+    initialize_memory_virtual() in both runs.
+    Thread arenas carved after the snapshot was taken would be wiped by
+    the restore, so that restore is refused.
+
+    save_permanent_snapshot_async() forks; the child writes the file while
+    the kernel's copy-on-write keeps its view frozen, so the frame doesn't
+    stall. Poll snapshot_finished() with the returned id.
+    Saves go to path.tmp and are renamed over path when complete, so a
+    failed save keeps the previous snapshot.
+    restore_permanent_snapshot() maps the file copy-on-write over the
+    block, so the restore itself doesn't depend on the size: pages are read
+    in as they are first touched. Saves replace the file by rename, so a
+    later save never changes what an earlier restore mapped; don't edit
+    snapshot files in place. Storage that isn't page aligned (plain
+    malloc'd arenas) and Windows read the file instead.
+    The free_block() lists live outside the block, so a restore empties
+    them: blocks freed before the restore may be in use again. Pools and
+    lists kept inside PermanentStorage come back with it.
+*/
+#define B_SNAPSHOT_MAGIC 0x504e5342 // "BSNP"
+#define B_SNAPSHOT_VERSION 1
+
+struct SnapshotHeader
+{
+    u4 magic;
+    u4 version;
+    uint64_t base;  // PermanentStorage when saved
+    uint64_t used;  // memory.current when saved
+};
+
+// path + ".tmp" into out, false if it doesn't fit. No libc formatting, safe after fork
+inline b4 snapshot_temp_path(const char* path, char* out, u4 out_size)
+{
+    u4 length = (u4)strlen(path);
+    if (length + 5 > out_size) {
+        return false;
+    }
+    memcpy(out, path, length);
+    memcpy(out + length, ".tmp", 5);
+    return true;
+}
+
+// Header is padded to a page so the data starts page aligned in the file and can be mapped
+#if defined(_WIN32)
+b4 write_snapshot(GameMemory &memory, const char* path)
+{
+    char temp_path[MAX_PATH];
+    if (!snapshot_temp_path(path, temp_path, sizeof(temp_path))) {
+        return false;
+    }
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        return false;
+    }
+    u1 header_page[B_PAGE_SIZE] = {};
+    SnapshotHeader* header = (SnapshotHeader*)header_page;
+    header->magic = B_SNAPSHOT_MAGIC;
+    header->version = B_SNAPSHOT_VERSION;
+    header->base = (uint64_t)(uintptr_t)memory.PermanentStorage;
+    header->used = memory.current;
+    b4 ok = fwrite(header_page, B_PAGE_SIZE, 1, file) == 1
+         && fwrite(memory.PermanentStorage, 1, memory.current, file) == memory.current;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        remove(temp_path);
+        return false;
+    }
+    return MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#else
+// Only uses syscalls, so it is safe in a forked child
+b4 write_snapshot(GameMemory &memory, const char* path)
+{
+    char temp_path[4096];
+    if (!snapshot_temp_path(path, temp_path, sizeof(temp_path))) {
+        return false;
+    }
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    u1 header_page[B_PAGE_SIZE] = {};
+    SnapshotHeader* header = (SnapshotHeader*)header_page;
+    header->magic = B_SNAPSHOT_MAGIC;
+    header->version = B_SNAPSHOT_VERSION;
+    header->base = (uint64_t)(uintptr_t)memory.PermanentStorage;
+    header->used = memory.current;
+
+    b4 ok = write(fd, header_page, B_PAGE_SIZE) == B_PAGE_SIZE;
+    u1* data = (u1*)memory.PermanentStorage;
+    uint64_t left = memory.current;
+    while (ok && left > 0)
+    {
+        ssize_t written = write(fd, data, left);
+        if (written <= 0) {
+            ok = false;
+        } else {
+            data += written;
+            left -= written;
+        }
+    }
+    ok = close(fd) == 0 && ok;
+    if (!ok) {
+        unlink(temp_path);
+        return false;
+    }
+    return rename(temp_path, path) == 0;
+}
+#endif
+
+inline b4 save_permanent_snapshot(GameMemory &memory, const char* path)
+{
+    return write_snapshot(memory, path);
+}
+
+// Returns an id for snapshot_finished(), or -1 on failure
+s8 save_permanent_snapshot_async(GameMemory &memory, const char* path)
+{
+#if defined(_WIN32)
+    return write_snapshot(memory, path) ? 0 : -1;
+#else
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(write_snapshot(memory, path) ? 0 : 1);
+    }
+    return pid;
+#endif
+}
+
+// Also true if the save failed, check success if it matters
+b4 snapshot_finished(s8 id, b4* success = 0)
+{
+#if defined(_WIN32)
+    if (success) {
+        *success = id == 0;
+    }
+    return true;
+#else
+    int status = 0;
+    pid_t result = waitpid((pid_t)id, &status, WNOHANG);
+    if (result == 0) {
+        return false;
+    }
+    if (success) {
+        *success = result == id && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return true;
+#endif
+}
+
+b4 restore_permanent_snapshot(GameMemory &memory, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    SnapshotHeader header = {};
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || header.magic != B_SNAPSHOT_MAGIC || header.version != B_SNAPSHOT_VERSION
+        || header.base != (uint64_t)(uintptr_t)memory.PermanentStorage)
+    {
+        #ifdef MEM_DEBUG
+            std::cout << "ERROR: Snapshot doesn't match this memory." << std::endl;
+        #endif
+        fclose(file);
+        return false;
+    }
+    if (header.used > memory.PermanentStorageSize
+        && !(memory.PermanentReserveSize && grow_permanent(memory, header.used)))
+    {
+        fclose(file);
+        return false;
+    }
+    // the thread arena table would be zeroed while memory still points at it
+    uintptr_t arenas = (uintptr_t)memory.thread_arenas;
+    uintptr_t kept_end = (uintptr_t)memory.PermanentStorage + header.used;
+    if (arenas >= kept_end && arenas < (uintptr_t)memory.PermanentStorage + memory.current)
+    {
+        #ifdef MEM_DEBUG
+            std::cout << "ERROR: Thread arenas were created after the snapshot." << std::endl;
+        #endif
+        fclose(file);
+        return false;
+    }
+
+    u1* storage = (u1*)memory.PermanentStorage;
+    uint64_t old_current = memory.current;
+    uint64_t mapped = 0;
+#if !defined(_WIN32)
+    // whole pages are mapped, the ragged end is read below
+    if (((uintptr_t)storage & (B_PAGE_SIZE - 1)) == 0) {
+        mapped = header.used & ~((uint64_t)B_PAGE_SIZE - 1);
+        // touching a page past the end of the file would SIGBUS
+        struct stat info;
+        if (mapped && (fstat(fileno(file), &info) != 0
+            || (uint64_t)info.st_size < B_PAGE_SIZE + header.used
+            || mmap(storage, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                    fileno(file), B_PAGE_SIZE) == MAP_FAILED))
+        {
+            mapped = 0;
+        }
+    }
+#endif
+    b4 ok = fseek(file, (long)(B_PAGE_SIZE + mapped), SEEK_SET) == 0
+         && fread(storage + mapped, 1, header.used - mapped, file) == header.used - mapped;
+    fclose(file);
+    if (!ok) {
+        return false;
+    }
+
+    // freed blocks were recorded against the old state, forget them
+    memset(memory.free_blocks, 0, sizeof(memory.free_blocks));
+
+    // anything allocated after the snapshot goes back to zero
+    memory.current = header.used;
+    if (old_current > header.used) {
+        if (memory.PermanentReserveSize) {
+            zero_mapped_pages(storage + header.used, old_current - header.used);
+        } else {
+            memset(storage + header.used, 0, old_current - header.used);
+        }
+    }
+    return true;
+}
+
 // Print out structure
 void check_storage(GameMemory &memory)
 {
@@ -103,6 +1046,24 @@ void check_storage(GameMemory &memory)
     std::cout << "Bytes in use:     " << memory.transient_current << std::endl;
     std::cout << "Bytes left:       " << (memory.TransientStorageSize - memory.transient_current)  << std::endl;
     std::cout << "Bytes total:      " << memory.TransientStorageSize  << std::endl; 
+    if (memory.stats)
+    {
+        MemoryStats* stats = memory.stats;
+        const MemoryFrameStats* last = memory_frame_stats(memory);
+        std::cout << "Peak ever:        " << stats->transient_peak << std::endl;
+        if (last) {
+            std::cout << "Peak last frame:  " << last->transient_peak << std::endl;
+            std::cout << "Thread peak:      " << last->thread_arena_peak << std::endl;
+        }
+        std::cout << std::endl; 
+        std::cout << "---------- Allocations by tag ------------------" << std::endl;  
+        for (u4 i = 0; i < MEM_STATS_TAGS; i++) {
+            if (stats->tags[i].count) {
+                std::cout << i << " " << (stats->tags[i].name ? stats->tags[i].name : "") << ": "
+                          << stats->tags[i].count << " allocs, " << stats->tags[i].bytes << " bytes" << std::endl;
+            }
+        }
+    }
     std::cout << "/------------------------------------------------" << std::endl;  
     std::cout << std::endl;  
 } 
@@ -129,6 +1090,46 @@ void initialize_memory(GameMemory &memory, uint64_t num_megabytes, uint64_t tran
     memory.TransientStorage = malloc(memory.TransientStorageSize);
     memory.transient_current = 0; 
     memset(memory.TransientStorage,0,memory.TransientStorageSize);  
+
+    #ifndef MEM_NO_STATS
+        memory.stats = (MemoryStats*)calloc(1, sizeof(MemoryStats));
+    #endif
+}
+
+/*
+    Same layout as initialize_memory(), but backed by reserved address space.
+    Permanent storage starts with commit_megabytes committed and grows in
+    place up to reserve_megabytes. Transient storage is committed up front,
+    its pages are still only backed once touched.
+    huge_pages asks the kernel for transparent hugepages (ignored on Windows).
+    permanent_base pins permanent storage to a fixed address so snapshots
+    can be restored by a later run, e.g. (void*)0x200000000000.
+*/
+void initialize_memory_virtual(GameMemory &memory, uint64_t reserve_megabytes, uint64_t commit_megabytes,
+                               uint64_t trans_megabytes = 1, b4 huge_pages = false, void* permanent_base = 0)
+{
+    memory = {};
+    memory.PermanentReserveSize = Megabytes((uint64_t)reserve_megabytes);
+    memory.PermanentStorage = reserve_pages(memory.PermanentReserveSize, huge_pages, permanent_base);
+    memory.TransientReserveSize = Megabytes((uint64_t)trans_megabytes);
+    memory.TransientStorage = reserve_pages(memory.TransientReserveSize, huge_pages);
+    #ifdef MEM_DEBUG
+        if (!memory.PermanentStorage || !memory.TransientStorage) {
+            std::cout << "ERROR: Failed to reserve memory." << std::endl;
+        }
+    #endif
+
+    memory.current = 0;
+    memory.isInitialized = true;
+    grow_permanent(memory, Megabytes((uint64_t)commit_megabytes));
+
+    commit_pages(memory.TransientStorage, memory.TransientReserveSize);
+    memory.TransientStorageSize = memory.TransientReserveSize;
+    memory.transient_current = 0;
+
+    #ifndef MEM_NO_STATS
+        memory.stats = (MemoryStats*)calloc(1, sizeof(MemoryStats));
+    #endif
 }
 
 #endif // _GAME_MEMORY_H_
@@ -8,37 +8,67 @@ Keeps blist of objects in quadtree.
 Uses transient memory for splitting quads and keeping new blists.
 Transient memory should be emptied at the end of every physics step
 
+Broadphase:
+get_collision_pairs() writes every candidate pair once into one flat
+transient list. Bounds tests run 4 wide with SSE2 when available.
+
+build_quads_parallel():
+Same tree, built on a JobPool. Needs b_jobs.h included first.
+
+IncrementalQuadTree:
+Lives across steps, only entities that left their leaf are moved.
+Needs b_hashmap.h included first.
+
+BQuadTree<Record, MaxLevels, MaxEntities, WorldSize>:
+Keeps QuadPoint / QuadBox records inline in the leaves instead of Enemy*.
+Limits are template parameters, so several trees can live side by side.
+
+LinearQuadTree:
+Same world and limits, rebuilt every step from Morton codes.
+Needs b_sort.h included first.
+
 */
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>  /* _mm_cmple_ps */
+#define B_QUAD_SIMD
+#endif
+
 const s4 MAX_ENTITIES = 10;
 const s4 MAX_LEVELS = 4;
 const f4 QUAD_SIZE = 4000.0f;
 
 struct QuadTree
 { 
+	// a leaf holds MAX_ENTITIES + 1 before it splits, only MAX_LEVELS leaves spill
+	typedef bsmall<void*, MAX_ENTITIES + 1> EntityList;
+
 	struct Quad { 
-		blist list_enemies;
+		EntityList list_enemies;
 		s4 level;
 		b4 has_children;
 		f4 width;
 		vec2 pos;
 		Quad* quads;
+		Quad* parent;
+		u4 index; // leaf order, only valid during get_collision_pairs
 	};
 
 	Quad* quads;
 };
 
-void split_quad(QuadTree* tree, QuadTree::Quad* quad);
+void split_quad(QuadTree* tree, QuadTree::Quad* quad, GameMemory &mem = memory);
 
 void init_quads(QuadTree* tree)
 {
 	tree->quads = (QuadTree::Quad*)alloc(memory,sizeof(QuadTree::Quad) * 4);
 
 	for (s4 i = 0; i < 4; i++) {
-		tree->quads[i].list_enemies.set(memory,sizeof(Enemy*),MAX_ENTITIES * 2);
+		tree->quads[i].list_enemies.set(memory);
 		tree->quads[i].has_children = false;
 		tree->quads[i].level = 1;
 		tree->quads[i].quads = 0;
+		tree->quads[i].parent = 0;
 		tree->quads[i].width = QUAD_SIZE;
 	}
 	tree->quads[0].pos = vec2(-QUAD_SIZE/2.0f,QUAD_SIZE/2.0f);
@@ -55,16 +85,18 @@ void clear_quads(QuadTree* tree)
 	}
 }
 
-void add_to_quad(QuadTree* tree, QuadTree::Quad* quad, void* obj)
+// mem is where split quads go, a worker's scratch arena when building in parallel
+void add_to_quad(QuadTree* tree, QuadTree::Quad* quad, void* obj, GameMemory &mem = memory)
 {
 	quad->list_enemies.push(obj);
 	if (quad->list_enemies.size() > MAX_ENTITIES && quad->level < MAX_LEVELS)
 	{
-		split_quad(tree,quad);
+		split_quad(tree,quad,mem);
 	}
 }
 
-void find_and_add_to_quad(QuadTree* tree, void* obj, vec2 pos, QuadTree::Quad* found_quad = 0, vec2 quad_pos = vec2(0,0))
+void find_and_add_to_quad(QuadTree* tree, void* obj, vec2 pos, QuadTree::Quad* found_quad = 0, vec2 quad_pos = vec2(0,0),
+	GameMemory &mem = memory)
 {  
 	QuadTree::Quad* quads;
 
@@ -85,18 +117,28 @@ void find_and_add_to_quad(QuadTree* tree, void* obj, vec2 pos, QuadTree::Quad* f
 
 	if (found_quad->has_children)
 	{
-		find_and_add_to_quad(tree,obj,pos,found_quad, found_quad->pos);
+		find_and_add_to_quad(tree,obj,pos,found_quad, found_quad->pos, mem);
 	}
 	else
 	{ 
-		add_to_quad(tree, found_quad, obj);
+		add_to_quad(tree, found_quad, obj, mem);
 	}
 }
 
-void split_quad(QuadTree* tree, QuadTree::Quad* quad)
+// Same tie breaking as find_and_add_to_quad
+inline s4 quad_child_index(vec2 pos, vec2 quad_pos)
+{
+	if (pos.x <= quad_pos.x && pos.y >= quad_pos.y) return 0;
+	if (pos.x >= quad_pos.x && pos.y >= quad_pos.y) return 1;
+	if (pos.x >= quad_pos.x && pos.y <= quad_pos.y) return 2;
+	return 3;
+}
+
+// Set up 4 empty children under quad
+void init_child_quads(QuadTree::Quad* quad, QuadTree::Quad* children, b4 use_transient, GameMemory &mem = memory)
 {
 	quad->has_children = true;
-	quad->quads = (QuadTree::Quad*)alloc_transient(memory,sizeof(QuadTree::Quad) * 4);
+	quad->quads = children;
 	s4 level = quad->level+1;
 
 	f4 half_width = QUAD_SIZE;
@@ -107,23 +149,29 @@ void split_quad(QuadTree* tree, QuadTree::Quad* quad)
 
 	for (s4 i = 0; i < 4; i++)
 	{
-		quad->quads[i].list_enemies.set(memory,sizeof(Enemy*),MAX_ENTITIES * 2, true);
+		quad->quads[i].list_enemies.set(mem, use_transient);
 		quad->quads[i].has_children = false; 
 		quad->quads[i].level = level;
 		quad->quads[i].width = half_width * 2.0f;
 		quad->quads[i].quads = 0;
+		quad->quads[i].parent = quad;
 	}
 	
 	quad->quads[0].pos = quad->pos + vec2(-half_width,half_width);
 	quad->quads[1].pos = quad->pos + vec2(half_width,half_width);
 	quad->quads[2].pos = quad->pos + vec2(half_width,-half_width);
 	quad->quads[3].pos = quad->pos + vec2(-half_width,-half_width); 
+}
+
+void split_quad(QuadTree* tree, QuadTree::Quad* quad, GameMemory &mem)
+{
+	init_child_quads(quad, (QuadTree::Quad*)alloc_transient_aligned(mem,sizeof(QuadTree::Quad) * 4, alignof(QuadTree::Quad)), true, mem);
 
-	blist* ent_list = &quad->list_enemies;
-	for (s4 i = 0; i < ent_list->size(); i++)
+	QuadTree::EntityList* ent_list = &quad->list_enemies;
+	for (u4 i = 0; i < ent_list->size(); i++)
 	{
 		Enemy* enemy = (Enemy*)(*ent_list)[i];
-		find_and_add_to_quad(tree, enemy, enemy->curr_pos, quad, quad->pos);
+		find_and_add_to_quad(tree, enemy, enemy->curr_pos, quad, quad->pos, mem);
 	}
 }
 
@@ -148,7 +196,7 @@ QuadTree::Quad* get_quad_from_pos(QuadTree* tree, vec2 pos, QuadTree::Quad* foun
 
 	if (found_quad->has_children)
 	{
-		get_quad_from_pos(tree,pos,found_quad, found_quad->pos);
+		return get_quad_from_pos(tree,pos,found_quad, found_quad->pos);
 	}
 	else
 	{
@@ -156,8 +204,798 @@ QuadTree::Quad* get_quad_from_pos(QuadTree* tree, vec2 pos, QuadTree::Quad* foun
 	}
 }
 
-blist* get_list_from_quad(QuadTree* tree, vec2 pos)
+QuadTree::EntityList* get_list_from_quad(QuadTree* tree, vec2 pos)
 {
 	QuadTree::Quad* fq = get_quad_from_pos(tree,pos);
 	return &fq->list_enemies;
-}
\ No newline at end of file
+}
+
+/*
+	Range queries.
+	Visit every leaf overlapping the range with an explicit stack and push
+	the entities actually inside it to out, which the caller sets up
+	(usually in transient memory). Entities live in exactly one leaf, so
+	there are no duplicates.
+*/
+template <typename OverlapsQuad, typename VisitLeaf>
+void visit_quads(QuadTree* tree, OverlapsQuad overlaps_quad, VisitLeaf visit_leaf)
+{
+	QuadTree::Quad* stack[4 * MAX_LEVELS];
+	s4 top = 0;
+	for (s4 i = 0; i < 4; i++) {
+		stack[top++] = &tree->quads[i];
+	}
+	while (top > 0)
+	{
+		QuadTree::Quad* quad = stack[--top];
+		if (!overlaps_quad(quad->pos, quad->width * 0.5f)) {
+			continue;
+		}
+		if (quad->has_children) {
+			for (s4 i = 0; i < 4; i++) {
+				stack[top++] = &quad->quads[i];
+			}
+			continue;
+		}
+		visit_leaf(quad);
+	}
+}
+
+template <typename OverlapsQuad, typename Contains>
+void query_quads(QuadTree* tree, OverlapsQuad overlaps_quad, Contains contains, btlist<void*>* out)
+{
+	visit_quads(tree, overlaps_quad, [&](QuadTree::Quad* quad) {
+		QuadTree::EntityList &list = quad->list_enemies;
+		for (u4 i = 0; i < list.size(); i++)
+		{
+			Enemy* enemy = (Enemy*)list[i];
+			if (contains(enemy->curr_pos)) {
+				out->push(enemy);
+			}
+		}
+	});
+}
+
+void get_entities_in_box(QuadTree* tree, vec2 min, vec2 max, btlist<void*>* out)
+{
+	query_quads(tree,
+		[&](vec2 center, f4 half) {
+			return center.x + half >= min.x && center.x - half <= max.x
+			    && center.y + half >= min.y && center.y - half <= max.y;
+		},
+		[&](vec2 pos) {
+			return pos.x >= min.x && pos.x <= max.x && pos.y >= min.y && pos.y <= max.y;
+		},
+		out);
+}
+
+void get_entities_in_circle(QuadTree* tree, vec2 center, f4 radius, btlist<void*>* out)
+{
+	f4 radius_sq = radius * radius;
+	query_quads(tree,
+		[&](vec2 quad_center, f4 half) {
+			// distance from the circle to the closest point of the quad
+			f4 dx = fabsf(center.x - quad_center.x) - half;
+			f4 dy = fabsf(center.y - quad_center.y) - half;
+			dx = dx > 0.0f ? dx : 0.0f;
+			dy = dy > 0.0f ? dy : 0.0f;
+			return dx * dx + dy * dy <= radius_sq;
+		},
+		[&](vec2 pos) {
+			f4 dx = pos.x - center.x;
+			f4 dy = pos.y - center.y;
+			return dx * dx + dy * dy <= radius_sq;
+		},
+		out);
+}
+
+/*
+	Broadphase.
+	Entities are treated as squares of half width radius, a candidate pair
+	is two of them closer than 2 * radius on both axes. Positions of all
+	leaves are copied into flat x/y arrays first, then each leaf is tested
+	against itself and against the neighbour leaves that come after it in
+	leaf order, so every pair comes out once.
+*/
+struct QuadPair
+{
+	void* a;
+	void* b;
+};
+
+inline void quad_pair_test(void* a, f4 ax, f4 ay, const f4* xs, const f4* ys, void** objs,
+	u4 k, f4 reach, btlist<QuadPair>* out)
+{
+	f4 dx = fabsf(xs[k] - ax);
+	f4 dy = fabsf(ys[k] - ay);
+	if (dx <= reach && dy <= reach) {
+		QuadPair* pair = out->push();
+		pair->a = a;
+		pair->b = objs[k];
+	}
+}
+
+// a against entities [begin, end) of the flat arrays, xs and ys are 16 byte aligned
+inline void quad_pairs_against(void* a, f4 ax, f4 ay, const f4* xs, const f4* ys, void** objs,
+	u4 begin, u4 end, f4 reach, btlist<QuadPair>* out)
+{
+	u4 k = begin;
+#ifdef B_QUAD_SIMD
+	// scalar up to the next group of 4, so the loads below are aligned
+	for (; k < end && (k & 3); k++) {
+		quad_pair_test(a, ax, ay, xs, ys, objs, k, reach, out);
+	}
+	__m128 vax = _mm_set1_ps(ax);
+	__m128 vay = _mm_set1_ps(ay);
+	__m128 vreach = _mm_set1_ps(reach);
+	__m128 sign = _mm_set1_ps(-0.0f);
+	for (; k + 4 <= end; k += 4)
+	{
+		__m128 dx = _mm_andnot_ps(sign, _mm_sub_ps(_mm_load_ps(xs + k), vax));
+		__m128 dy = _mm_andnot_ps(sign, _mm_sub_ps(_mm_load_ps(ys + k), vay));
+		s4 mask = _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(dx, vreach), _mm_cmple_ps(dy, vreach)));
+		for (s4 bit = 0; mask; bit++, mask >>= 1) {
+			if (mask & 1) {
+				QuadPair* pair = out->push();
+				pair->a = a;
+				pair->b = objs[k + bit];
+			}
+		}
+	}
+#endif
+	for (; k < end; k++) {
+		quad_pair_test(a, ax, ay, xs, ys, objs, k, reach, out);
+	}
+}
+
+// out is set up by the caller, the flat arrays are left in transient memory
+void get_collision_pairs(QuadTree* tree, f4 radius, btlist<QuadPair>* out)
+{
+	f4 reach = radius * 2.0f;
+
+	btlist<QuadTree::Quad*> leaves;
+	leaves.set(memory, 64, true);
+	u4 count = 0;
+	visit_quads(tree,
+		[](vec2, f4) { return true; },
+		[&](QuadTree::Quad* quad) {
+			quad->index = leaves.size();
+			leaves.push(quad);
+			count += quad->list_enemies.size();
+		});
+
+	u4* starts = (u4*)alloc_transient_aligned(memory, sizeof(u4) * (leaves.size() + 1), 16);
+	f4* xs = (f4*)alloc_transient_aligned(memory, sizeof(f4) * (count + 1), 16);
+	f4* ys = (f4*)alloc_transient_aligned(memory, sizeof(f4) * (count + 1), 16);
+	void** objs = (void**)alloc_transient_aligned(memory, sizeof(void*) * (count + 1), sizeof(void*));
+	u4 n = 0;
+	for (u4 i = 0; i < leaves.size(); i++)
+	{
+		starts[i] = n;
+		QuadTree::EntityList &list = leaves[i]->list_enemies;
+		for (u4 j = 0; j < list.size(); j++, n++)
+		{
+			Enemy* enemy = (Enemy*)list[j];
+			xs[n] = enemy->curr_pos.x;
+			ys[n] = enemy->curr_pos.y;
+			objs[n] = enemy;
+		}
+	}
+	starts[leaves.size()] = n;
+
+	for (u4 i = 0; i < leaves.size(); i++)
+	{
+		u4 begin = starts[i];
+		u4 end = starts[i + 1];
+		if (begin == end) {
+			continue;
+		}
+		for (u4 j = begin; j < end; j++) {
+			quad_pairs_against(objs[j], xs[j], ys[j], xs, ys, objs, j + 1, end, reach, out);
+		}
+
+		QuadTree::Quad* leaf = leaves[i];
+		f4 leaf_half = leaf->width * 0.5f;
+		visit_quads(tree,
+			[&](vec2 center, f4 half) {
+				return fabsf(center.x - leaf->pos.x) <= half + leaf_half + reach
+				    && fabsf(center.y - leaf->pos.y) <= half + leaf_half + reach;
+			},
+			[&](QuadTree::Quad* other) {
+				if (other->index <= i) {
+					return;
+				}
+				for (u4 j = begin; j < end; j++) {
+					quad_pairs_against(objs[j], xs[j], ys[j], xs, ys, objs,
+						starts[other->index], starts[other->index + 1], reach, out);
+				}
+			});
+	}
+}
+
+#ifdef _INCLUDE_BJOBS_
+/*
+	Parallel build.
+	The calling thread sorts the entities by root quad into one transient
+	array. Any quad holding more than its share is split right away and its
+	entities sorted again by child, until every task is small enough to
+	balance. Each task is then a separate subtree built on a worker with
+	find_and_add_to_quad() as usual, splitting into that worker's scratch
+	arena, so the workers never share a cursor or a node.
+	Call clear_quads() first. The scratch arenas are emptied with the
+	transient memory at the end of the step.
+*/
+struct QuadBuildTask
+{
+	QuadTree::Quad* quad;
+	u4 begin; // entities [begin, end) of the sorted array
+	u4 end;
+};
+
+// Sort objs [begin, end) into the 4 children of center, writes the 5 bounds to first
+void partition_quad_entities(void** objs, void** temp, u4 begin, u4 end, vec2 center, u4* first)
+{
+	u4 counts[4] = {0, 0, 0, 0};
+	for (u4 i = begin; i < end; i++) {
+		counts[quad_child_index(((Enemy*)objs[i])->curr_pos, center)]++;
+	}
+	first[0] = begin;
+	for (s4 i = 0; i < 4; i++) {
+		first[i + 1] = first[i] + counts[i];
+	}
+	u4 next[4] = {first[0], first[1], first[2], first[3]};
+	for (u4 i = begin; i < end; i++) {
+		temp[next[quad_child_index(((Enemy*)objs[i])->curr_pos, center)]++] = objs[i];
+	}
+	memcpy((void*)(objs + begin), (void*)(temp + begin), sizeof(void*) * (end - begin));
+}
+
+// list holds entity pointers, blist / btlist
+template <typename L>
+void build_quads_parallel(JobPool &pool, QuadTree* tree, L &list)
+{
+	u4 count = list.length;
+	void** objs = (void**)alloc_transient_aligned(memory, sizeof(void*) * (count + 1), sizeof(void*));
+	void** temp = (void**)alloc_transient_aligned(memory, sizeof(void*) * (count + 1), sizeof(void*));
+	for (u4 i = 0; i < count; i++) {
+		objs[i] = list[i];
+	}
+
+	// a few tasks per worker so stealing can even out what is left
+	u4 task_limit = count / (pool.worker_count * 4) + 1;
+	if (task_limit <= (u4)MAX_ENTITIES) {
+		task_limit = MAX_ENTITIES + 1;
+	}
+
+	btlist<QuadBuildTask> pending;
+	btlist<QuadBuildTask> tasks;
+	pending.set(memory, 16, true);
+	tasks.set(memory, pool.worker_count * 8, true);
+
+	u4 first[5];
+	partition_quad_entities(objs, temp, 0, count, vec2(0,0), first);
+	for (s4 i = 0; i < 4; i++) {
+		QuadBuildTask* task = pending.push();
+		task->quad = &tree->quads[i];
+		task->begin = first[i];
+		task->end = first[i + 1];
+	}
+	while (pending.size() > 0)
+	{
+		QuadBuildTask task = *pending.last();
+		pending.pop();
+		if (task.end - task.begin <= task_limit || task.quad->level >= MAX_LEVELS) {
+			if (task.end > task.begin) {
+				tasks.push(task);
+			}
+			continue;
+		}
+		QuadTree::Quad* quad = task.quad;
+		init_child_quads(quad, (QuadTree::Quad*)alloc_transient_aligned(memory, sizeof(QuadTree::Quad) * 4, alignof(QuadTree::Quad)), true);
+		partition_quad_entities(objs, temp, task.begin, task.end, quad->pos, first);
+		for (s4 i = 0; i < 4; i++) {
+			QuadBuildTask* child = pending.push();
+			child->quad = &quad->quads[i];
+			child->begin = first[i];
+			child->end = first[i + 1];
+		}
+	}
+
+	parallel_for(pool, tasks.size(), 1, [&](u4 begin, u4 end, u4, GameMemory &scratch) {
+		for (u4 t = begin; t < end; t++)
+		{
+			QuadBuildTask &task = tasks[t];
+			QuadTree::Quad* quad = task.quad;
+			// a split-off leaf may spill at MAX_LEVELS, keep that off the shared cursor
+			if (quad->level > 1) {
+				quad->list_enemies.set(scratch, true);
+			}
+			for (u4 i = task.begin; i < task.end; i++)
+			{
+				void* obj = objs[i];
+				if (quad->has_children) {
+					find_and_add_to_quad(tree, obj, ((Enemy*)obj)->curr_pos, quad, quad->pos, scratch);
+				} else {
+					add_to_quad(tree, quad, obj, scratch);
+				}
+			}
+		}
+	});
+}
+#endif
+
+#ifdef _INCLUDE_BHASHMAP_
+/*
+	Incremental quadtree.
+	Children come from a pool and leaf lists from permanent memory, so the
+	tree is kept across steps instead of cleared. A hash map remembers the
+	leaf of every entity: update only moves entities that left their leaf,
+	and 4 sibling leaves are merged back into their parent once they hold
+	MERGE_ENTITIES or fewer. Entities are read through curr_pos like
+	split_quad, set it before calling update.
+*/
+const s4 MERGE_ENTITIES = MAX_ENTITIES / 2;
+
+struct IncrementalQuadTree
+{
+	QuadTree tree;
+	MemoryPool children; // blocks of 4 quads
+	bhashmap<void*, QuadTree::Quad*> leaf_of;
+};
+
+void init_incremental_quads(IncrementalQuadTree* inc, u4 expected_entities)
+{
+	init_quads(&inc->tree);
+	pool_set(inc->children, memory, sizeof(QuadTree::Quad) * 4, 16);
+	inc->leaf_of.set(memory, expected_entities);
+}
+
+void incremental_split(IncrementalQuadTree* inc, QuadTree::Quad* quad);
+
+void incremental_insert(IncrementalQuadTree* inc, QuadTree::Quad* quad, void* obj)
+{
+	vec2 pos = ((Enemy*)obj)->curr_pos;
+	while (quad->has_children) {
+		quad = &quad->quads[quad_child_index(pos, quad->pos)];
+	}
+	quad->list_enemies.push(obj);
+	inc->leaf_of.insert(obj, quad);
+	if (quad->list_enemies.size() > MAX_ENTITIES && quad->level < MAX_LEVELS)
+	{
+		incremental_split(inc, quad);
+	}
+}
+
+void incremental_split(IncrementalQuadTree* inc, QuadTree::Quad* quad)
+{
+	init_child_quads(quad, (QuadTree::Quad*)pool_alloc(inc->children), false);
+	QuadTree::EntityList &list = quad->list_enemies;
+	for (u4 i = 0; i < list.size(); i++)
+	{
+		incremental_insert(inc, quad, list[i]);
+	}
+	list.clear();
+}
+
+// Fold children back into quad while they are all leaves and few enough, then try the parent
+void incremental_merge(IncrementalQuadTree* inc, QuadTree::Quad* quad)
+{
+	for (; quad; quad = quad->parent)
+	{
+		u4 count = 0;
+		for (s4 i = 0; i < 4; i++)
+		{
+			if (quad->quads[i].has_children) {
+				return;
+			}
+			count += quad->quads[i].list_enemies.size();
+		}
+		if (count > (u4)MERGE_ENTITIES) {
+			return;
+		}
+		for (s4 i = 0; i < 4; i++)
+		{
+			QuadTree::EntityList &list = quad->quads[i].list_enemies;
+			for (u4 j = 0; j < list.size(); j++)
+			{
+				quad->list_enemies.push(list[j]);
+				inc->leaf_of.insert(list[j], quad);
+			}
+			if (list.heap) {
+				free_block(memory, list.heap, sizeof(void*) * list.max_length);
+			}
+		}
+		pool_free(inc->children, quad->quads);
+		quad->quads = 0;
+		quad->has_children = false;
+	}
+}
+
+void incremental_remove_from_leaf(QuadTree::Quad* leaf, void* obj)
+{
+	QuadTree::EntityList &list = leaf->list_enemies;
+	for (u4 i = 0; i < list.size(); i++)
+	{
+		if (list[i] == obj) {
+			list[i] = *list.last();
+			list.pop();
+			return;
+		}
+	}
+}
+
+void incremental_quads_add(IncrementalQuadTree* inc, void* obj)
+{
+	vec2 pos = ((Enemy*)obj)->curr_pos;
+	incremental_insert(inc, &inc->tree.quads[quad_child_index(pos, vec2(0,0))], obj);
+}
+
+void incremental_quads_remove(IncrementalQuadTree* inc, void* obj)
+{
+	QuadTree::Quad** found = inc->leaf_of.get(obj);
+	if (!found) {
+		return;
+	}
+	QuadTree::Quad* leaf = *found;
+	incremental_remove_from_leaf(leaf, obj);
+	inc->leaf_of.remove(obj);
+	incremental_merge(inc, leaf->parent);
+}
+
+// Call after curr_pos changed, returns true if the entity changed leaf.
+// Entities that aren't in the tree are ignored.
+b4 incremental_quads_update(IncrementalQuadTree* inc, void* obj)
+{
+	QuadTree::Quad** found = inc->leaf_of.get(obj);
+	if (!found) {
+		return false;
+	}
+	QuadTree::Quad* leaf = *found;
+	vec2 pos = ((Enemy*)obj)->curr_pos;
+	f4 half = leaf->width * 0.5f;
+	if (fabsf(pos.x - leaf->pos.x) < half && fabsf(pos.y - leaf->pos.y) < half) {
+		return false;
+	}
+	// on an edge or outside, the descent decides like it would on insert
+	if (get_quad_from_pos(&inc->tree, pos) == leaf) {
+		return false;
+	}
+	incremental_remove_from_leaf(leaf, obj);
+	incremental_merge(inc, leaf->parent);
+	incremental_quads_add(inc, obj);
+	return true;
+}
+#endif
+
+#ifdef _INCLUDE_BSORT_
+/*
+	Linear quadtree.
+	Every step: a Morton code per entity, one radix sort, then leaves are
+	cut from the sorted array in a single walk. No recursion and no
+	per-node allocation, just two flat transient arrays.
+	Codes have 16 bits per axis over the whole world; a quad at level L is
+	the run of entries sharing the top 2 * L bits.
+*/
+struct LinearQuadTree
+{
+	struct Entry {
+		u4 code;
+		vec2 pos;
+		void* obj;
+	};
+	struct Leaf {
+		u4 prefix; // code >> (32 - 2 * level)
+		u4 level;
+		u4 begin;  // entries [begin, end)
+		u4 end;
+	};
+
+	btlist<Entry> entries;
+	btlist<Leaf> leaves;
+};
+
+inline u4 morton_part(u4 v)
+{
+	v &= 0x0000FFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// 16 bits per axis over [-QUAD_SIZE, QUAD_SIZE], clamped to the world
+inline u4 morton_code(vec2 pos)
+{
+	f4 scale = 65536.0f / (QUAD_SIZE * 2.0f);
+	f4 x = (pos.x + QUAD_SIZE) * scale;
+	f4 y = (pos.y + QUAD_SIZE) * scale;
+	u4 qx = x <= 0.0f ? 0 : x >= 65535.0f ? 65535 : (u4)x;
+	u4 qy = y <= 0.0f ? 0 : y >= 65535.0f ? 65535 : (u4)y;
+	return (morton_part(qy) << 1) | morton_part(qx);
+}
+
+// Call every step before adding, the lists live in transient memory
+void linear_quads_begin(LinearQuadTree* tree, GameMemory &mem, u4 expected_entities)
+{
+	tree->entries.set(mem, expected_entities, true);
+	tree->leaves.set(mem, expected_entities / MAX_ENTITIES + 4, true);
+}
+
+inline void linear_quads_add(LinearQuadTree* tree, void* obj, vec2 pos)
+{
+	LinearQuadTree::Entry* entry = tree->entries.push();
+	entry->code = morton_code(pos);
+	entry->pos = pos;
+	entry->obj = obj;
+}
+
+void linear_quads_build(LinearQuadTree* tree, GameMemory &scratch)
+{
+	btlist<LinearQuadTree::Entry> &entries = tree->entries;
+	radix_sort(entries, [](const LinearQuadTree::Entry &e) { return e.code; }, scratch);
+
+	tree->leaves.length = 0;
+	u4 count = entries.size();
+	u4 i = 0;
+	while (i < count)
+	{
+		// shallowest quad starting at entries[i] that is small enough, or the deepest level
+		u4 level = 1;
+		u4 end = i + 1;
+		for (;; level++)
+		{
+			u4 shift = 32 - 2 * level;
+			u4 prefix = entries[i].code >> shift;
+			// an earlier leaf is in this quad too, so it was already split
+			if (i > 0 && (entries[i - 1].code >> shift) == prefix) {
+				continue;
+			}
+			// only need to know if it holds more than MAX_ENTITIES, unless it can't split
+			u4 limit = level == (u4)MAX_LEVELS ? count : i + MAX_ENTITIES + 1;
+			end = i + 1;
+			while (end < count && end < limit && (entries[end].code >> shift) == prefix) {
+				end++;
+			}
+			if (end - i <= (u4)MAX_ENTITIES || level == (u4)MAX_LEVELS) {
+				break;
+			}
+		}
+		LinearQuadTree::Leaf* leaf = tree->leaves.push();
+		leaf->prefix = entries[i].code >> (32 - 2 * level);
+		leaf->level = level;
+		leaf->begin = i;
+		leaf->end = end;
+		i = end;
+	}
+}
+
+// Leaf holding pos, 0 if that part of the world is empty
+LinearQuadTree::Leaf* get_linear_quad_from_pos(LinearQuadTree* tree, vec2 pos)
+{
+	u4 code = morton_code(pos);
+	btlist<LinearQuadTree::Leaf> &leaves = tree->leaves;
+	// last leaf whose quad starts at or before code, leaves are disjoint and in Morton order
+	u4 low = 0;
+	u4 high = leaves.size();
+	while (low < high)
+	{
+		u4 mid = (low + high) / 2;
+		u4 quad_start = leaves[mid].prefix << (32 - 2 * leaves[mid].level);
+		if (quad_start <= code) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (low == 0) {
+		return 0;
+	}
+	LinearQuadTree::Leaf* leaf = &leaves[low - 1];
+	if ((code >> (32 - 2 * leaf->level)) != leaf->prefix) {
+		return 0;
+	}
+	return leaf;
+}
+#endif
+
+/*
+	Templated quadtree.
+	Leaves hold the records themselves, an id plus position (and half
+	extent for boxes), so splitting and queries never follow a pointer.
+	World is [-WorldSize, WorldSize] on both axes like QUAD_SIZE, children
+	come from transient memory: clear() and refill every step.
+	Boxes are filed by center, queries grow by the largest half extent
+	inserted so far.
+*/
+template <typename Id>
+struct QuadPoint
+{
+	Id id;
+	vec2 pos;
+};
+
+template <typename Id>
+struct QuadBox
+{
+	Id id;
+	vec2 pos;
+	vec2 half;
+};
+
+template <typename Id>
+inline vec2 quad_record_half(const QuadPoint<Id> &)
+{
+	return vec2(0,0);
+}
+
+template <typename Id>
+inline vec2 quad_record_half(const QuadBox<Id> &record)
+{
+	return record.half;
+}
+
+template <typename Record, u4 MaxLevels, u4 MaxEntities, u4 WorldSize>
+struct BQuadTree
+{
+	struct Node {
+		bsmall<Record, MaxEntities + 1> records;
+		vec2 pos;
+		f4 half_width;
+		u4 level;
+		Node* children; // 0 for leaves
+	};
+
+	Node roots[4];
+	vec2 max_half;
+	GameMemory* mem_arena;
+
+	void set(GameMemory &memory)
+	{
+		mem_arena = &memory;
+		f4 half = (f4)WorldSize / 2.0f;
+		for (s4 i = 0; i < 4; i++)
+		{
+			roots[i].records.set(memory);
+			roots[i].half_width = half;
+			roots[i].level = 1;
+			roots[i].children = 0;
+		}
+		roots[0].pos = vec2(-half,half);
+		roots[1].pos = vec2(half,half);
+		roots[2].pos = vec2(half,-half);
+		roots[3].pos = vec2(-half,-half);
+		max_half = vec2(0,0);
+	}
+
+	// Children were transient, call after emptying it
+	void clear()
+	{
+		for (s4 i = 0; i < 4; i++)
+		{
+			roots[i].records.clear();
+			roots[i].children = 0;
+		}
+		max_half = vec2(0,0);
+	}
+
+	Node* find_leaf(vec2 pos)
+	{
+		Node* node = &roots[quad_child_index(pos, vec2(0,0))];
+		while (node->children) {
+			node = &node->children[quad_child_index(pos, node->pos)];
+		}
+		return node;
+	}
+
+	void insert(const Record &record)
+	{
+		vec2 half = quad_record_half(record);
+		max_half.x = half.x > max_half.x ? half.x : max_half.x;
+		max_half.y = half.y > max_half.y ? half.y : max_half.y;
+
+		Node* node = find_leaf(record.pos);
+		node->records.push(record);
+		// MaxEntities + 1 records can only overflow one child, follow it down
+		while (node->records.size() > MaxEntities && node->level < MaxLevels)
+		{
+			split(node);
+			Node* full = 0;
+			for (s4 i = 0; i < 4; i++) {
+				if (node->children[i].records.size() > MaxEntities) {
+					full = &node->children[i];
+				}
+			}
+			if (!full) {
+				break;
+			}
+			node = full;
+		}
+	}
+
+	// Records overlapping [min, max] are copied to out
+	void query_box(vec2 min, vec2 max, btlist<Record>* out)
+	{
+		query(
+			[&](vec2 center, vec2 reach) {
+				return center.x + reach.x >= min.x && center.x - reach.x <= max.x
+				    && center.y + reach.y >= min.y && center.y - reach.y <= max.y;
+			},
+			out);
+	}
+
+	// Records overlapping the circle are copied to out
+	void query_circle(vec2 center, f4 radius, btlist<Record>* out)
+	{
+		f4 radius_sq = radius * radius;
+		query(
+			[&](vec2 box_center, vec2 reach) {
+				// distance from the circle to the closest point of the box
+				f4 dx = fabsf(center.x - box_center.x) - reach.x;
+				f4 dy = fabsf(center.y - box_center.y) - reach.y;
+				dx = dx > 0.0f ? dx : 0.0f;
+				dy = dy > 0.0f ? dy : 0.0f;
+				return dx * dx + dy * dy <= radius_sq;
+			},
+			out);
+	}
+
+private:
+	void split(Node* node)
+	{
+		Node* children = (Node*)alloc_transient_aligned(*mem_arena, sizeof(Node) * 4, alignof(Node));
+		f4 half = node->half_width / 2.0f;
+		for (s4 i = 0; i < 4; i++)
+		{
+			new (&children[i]) Node;
+			children[i].records.set(*mem_arena, true);
+			children[i].half_width = half;
+			children[i].level = node->level + 1;
+			children[i].children = 0;
+		}
+		children[0].pos = node->pos + vec2(-half,half);
+		children[1].pos = node->pos + vec2(half,half);
+		children[2].pos = node->pos + vec2(half,-half);
+		children[3].pos = node->pos + vec2(-half,-half);
+
+		for (u4 i = 0; i < node->records.size(); i++)
+		{
+			Record &record = node->records[i];
+			children[quad_child_index(record.pos, node->pos)].records.push(record);
+		}
+		node->records.clear();
+		node->children = children;
+	}
+
+	// overlaps(center, reach) tests a node or record box against the query shape
+	template <typename Overlaps>
+	void query(Overlaps overlaps, btlist<Record>* out)
+	{
+		Node* stack[4 * MaxLevels];
+		s4 top = 0;
+		for (s4 i = 0; i < 4; i++) {
+			stack[top++] = &roots[i];
+		}
+		while (top > 0)
+		{
+			Node* node = stack[--top];
+			vec2 reach = vec2(node->half_width + max_half.x, node->half_width + max_half.y);
+			if (!overlaps(node->pos, reach)) {
+				continue;
+			}
+			if (node->children) {
+				for (s4 i = 0; i < 4; i++) {
+					stack[top++] = &node->children[i];
+				}
+				continue;
+			}
+			for (u4 i = 0; i < node->records.size(); i++)
+			{
+				Record &record = node->records[i];
+				if (overlaps(record.pos, quad_record_half(record))) {
+					out->push(record);
+				}
+			}
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,214 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Description: -------------------
+	radix sort
+	- LSD radix sort of blist / btlist contents by a 32 or 64 bit key
+	- key(item) returns u4 or u8, it is called once per item
+	- stable, 8 bits per pass, passes where every key has the same byte
+	  are skipped (Morton codes, material ids, quantized depth)
+	- needs 2 * count * (sizeof(item) + sizeof(key)) bytes of transient
+	  scratch, given back before returning
+	- items are moved with memcpy, so they must be plain data
+	- include b_jobs.h before this file for radix_sort_parallel()
+
+Functions:
+	radix_sort(): sort in place on the calling thread
+	radix_sort_parallel(): same result, histograms and scatter per chunk on a JobPool
+	key_batches(): runs of equal keys in a sorted list, for draw batching
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#ifndef _INCLUDE_BSORT_
+#define _INCLUDE_BSORT_
+
+#include <type_traits>
+
+struct SortBatch
+{
+	u4 begin;
+	u4 end;
+};
+
+template <typename T, typename K>
+void radix_sort_items(T* items, u4 count, K* keys, GameMemory &scratch)
+{
+	static_assert(std::is_trivially_destructible<T>::value, "radix_sort items must be plain data");
+	const u4 PASSES = sizeof(K);
+
+	TemporaryMemory temp = begin_temporary_memory(scratch);
+	T* items_other = (T*)alloc_transient_aligned(scratch, sizeof(T) * count);
+	K* keys_other = (K*)alloc_transient_aligned(scratch, sizeof(K) * count);
+	u4* histograms = (u4*)alloc_transient_aligned(scratch, sizeof(u4) * 256 * PASSES);
+	memset(histograms, 0, sizeof(u4) * 256 * PASSES);
+
+	// every pass's histogram in one read of the keys
+	for (u4 i = 0; i < count; i++) {
+		K key = keys[i];
+		for (u4 pass = 0; pass < PASSES; pass++) {
+			histograms[pass * 256 + ((key >> (pass * 8)) & 0xFF)]++;
+		}
+	}
+
+	T* items_from = items;
+	K* keys_from = keys;
+	T* items_to = items_other;
+	K* keys_to = keys_other;
+	for (u4 pass = 0; pass < PASSES; pass++)
+	{
+		u4* histogram = histograms + pass * 256;
+		u4 shift = pass * 8;
+		if (histogram[(keys_from[0] >> shift) & 0xFF] == count) {
+			continue;
+		}
+		u4 offset = 0;
+		for (u4 digit = 0; digit < 256; digit++) {
+			u4 digit_count = histogram[digit];
+			histogram[digit] = offset;
+			offset += digit_count;
+		}
+		for (u4 i = 0; i < count; i++) {
+			u4 dest = histogram[(keys_from[i] >> shift) & 0xFF]++;
+			keys_to[dest] = keys_from[i];
+			memcpy((void*)&items_to[dest], (const void*)&items_from[i], sizeof(T));
+		}
+		T* items_swap = items_from; items_from = items_to; items_to = items_swap;
+		K* keys_swap = keys_from; keys_from = keys_to; keys_to = keys_swap;
+	}
+	if (items_from != items) {
+		memcpy((void*)items, (const void*)items_from, sizeof(T) * count);
+	}
+	end_temporary_memory(temp);
+}
+
+// key(item) -> u4 or u8
+template <typename L, typename KeyFn>
+void radix_sort(L &list, KeyFn key, GameMemory &scratch)
+{
+	typedef typename std::remove_reference<decltype(list[0])>::type T;
+	typedef typename std::remove_cv<typename std::remove_reference<decltype(key(list[0]))>::type>::type K;
+	static_assert(std::is_same<K, u4>::value || std::is_same<K, u8>::value, "radix_sort keys are u4 or u8");
+
+	u4 count = list.length;
+	if (count < 2) {
+		return;
+	}
+	TemporaryMemory temp = begin_temporary_memory(scratch);
+	K* keys = (K*)alloc_transient_aligned(scratch, sizeof(K) * count);
+	T* items = &list[0];
+	for (u4 i = 0; i < count; i++) {
+		keys[i] = key(items[i]);
+	}
+	radix_sort_items(items, count, keys, scratch);
+	end_temporary_memory(temp);
+}
+
+// Runs of equal keys in a sorted list, appended to out
+template <typename L, typename KeyFn>
+void key_batches(L &list, KeyFn key, btlist<SortBatch> &out)
+{
+	u4 count = list.length;
+	u4 begin = 0;
+	while (begin < count)
+	{
+		u4 end = begin + 1;
+		auto batch_key = key(list[begin]);
+		while (end < count && key(list[end]) == batch_key) {
+			end++;
+		}
+		SortBatch* batch = out.push();
+		batch->begin = begin;
+		batch->end = end;
+		begin = end;
+	}
+}
+
+#ifdef _INCLUDE_BJOBS_
+/*
+	Parallel version. The list is cut into one chunk per worker; each pass
+	builds a histogram per chunk in parallel, a prefix sum over
+	(digit, chunk) gives every chunk its own output offsets, then every
+	chunk scatters in parallel. Same stable result as radix_sort().
+	Scratch comes from the pool's main GameMemory.
+*/
+template <typename L, typename KeyFn>
+void radix_sort_parallel(JobPool &pool, L &list, KeyFn key)
+{
+	typedef typename std::remove_reference<decltype(list[0])>::type T;
+	typedef typename std::remove_cv<typename std::remove_reference<decltype(key(list[0]))>::type>::type K;
+	static_assert(std::is_same<K, u4>::value || std::is_same<K, u8>::value, "radix_sort keys are u4 or u8");
+	static_assert(std::is_trivially_destructible<T>::value, "radix_sort items must be plain data");
+	const u4 PASSES = sizeof(K);
+
+	u4 count = list.length;
+	if (count < 2) {
+		return;
+	}
+	GameMemory &scratch = *pool.memory;
+	u4 chunk_size = (count + pool.worker_count - 1) / pool.worker_count;
+	// rounding up can leave fewer chunks than workers, only those have a histogram
+	u4 chunks = (count + chunk_size - 1) / chunk_size;
+
+	TemporaryMemory temp = begin_temporary_memory(scratch);
+	T* items = &list[0];
+	K* keys = (K*)alloc_transient_aligned(scratch, sizeof(K) * count);
+	T* items_other = (T*)alloc_transient_aligned(scratch, sizeof(T) * count);
+	K* keys_other = (K*)alloc_transient_aligned(scratch, sizeof(K) * count);
+	// one cache line aligned histogram per chunk, so workers don't share lines
+	u4* histograms = (u4*)alloc_transient_aligned(scratch, sizeof(u4) * 256 * chunks);
+
+	parallel_for(pool, count, chunk_size, [&](u4 begin, u4 end, u4, GameMemory&) {
+		for (u4 i = begin; i < end; i++) {
+			keys[i] = key(items[i]);
+		}
+	});
+
+	T* items_from = items;
+	K* keys_from = keys;
+	T* items_to = items_other;
+	K* keys_to = keys_other;
+	for (u4 pass = 0; pass < PASSES; pass++)
+	{
+		u4 shift = pass * 8;
+		parallel_for(pool, count, chunk_size, [&](u4 begin, u4 end, u4, GameMemory&) {
+			u4* histogram = histograms + (begin / chunk_size) * 256;
+			memset(histogram, 0, sizeof(u4) * 256);
+			for (u4 i = begin; i < end; i++) {
+				histogram[(keys_from[i] >> shift) & 0xFF]++;
+			}
+		});
+
+		// digit major, chunk minor: chunk c's run of digit d follows chunk c-1's
+		u4 offset = 0;
+		b4 one_digit = false;
+		for (u4 digit = 0; digit < 256; digit++) {
+			u4 digit_start = offset;
+			for (u4 chunk = 0; chunk < chunks; chunk++) {
+				u4 chunk_count = histograms[chunk * 256 + digit];
+				histograms[chunk * 256 + digit] = offset;
+				offset += chunk_count;
+			}
+			if (offset - digit_start == count) {
+				one_digit = true;
+			}
+		}
+		if (one_digit) {
+			continue;
+		}
+
+		parallel_for(pool, count, chunk_size, [&](u4 begin, u4 end, u4, GameMemory&) {
+			u4* histogram = histograms + (begin / chunk_size) * 256;
+			for (u4 i = begin; i < end; i++) {
+				u4 dest = histogram[(keys_from[i] >> shift) & 0xFF]++;
+				keys_to[dest] = keys_from[i];
+				memcpy((void*)&items_to[dest], (const void*)&items_from[i], sizeof(T));
+			}
+		});
+		T* items_swap = items_from; items_from = items_to; items_to = items_swap;
+		K* keys_swap = keys_from; keys_from = keys_to; keys_to = keys_swap;
+	}
+	if (items_from != items) {
+		memcpy((void*)items, (const void*)items_from, sizeof(T) * count);
+	}
+	end_temporary_memory(temp);
+}
+#endif
+
+#endif